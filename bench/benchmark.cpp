@@ -0,0 +1,214 @@
+// -------------------- BENCHMARKS --------------------
+// Microbenchmarks de las funciones mas usadas sobre un catalogo sintetico (determinista) de
+// varios tamanos. Cada caso se repite hasta juntar TIEMPO_MINIMO_NS y se informa el tiempo por
+// repeticion y el rendimiento (elementos/s y, si aplica, MB/s), para comparar entre versiones.
+//
+// Uso: PrograIII_Bench [peliculas ...]   (por defecto 1000 4000 16000)
+#define PROGRAIII_SIN_MAIN
+#include "../main.cpp"
+
+#include <random>
+
+const double TIEMPO_MINIMO_NS = 2e8;
+const int NUM_CONSULTAS = 64;
+const int NUM_USUARIOS = 64;
+const int GUSTADAS_POR_USUARIO = 5;
+
+size_t sumidero = 0;   // Se imprime al final para que el compilador no descarte los resultados
+
+// Repite f hasta que una tanda dure al menos TIEMPO_MINIMO_NS; devuelve ns por repeticion.
+template <typename Funcion>
+double medir(Funcion f) {
+    size_t repeticiones = 1;
+    while (true) {
+        auto inicio = chrono::steady_clock::now();
+        for (size_t i = 0; i < repeticiones; i++)
+            f();
+        double ns = chrono::duration<double, nano>(chrono::steady_clock::now() - inicio).count();
+        if (ns >= TIEMPO_MINIMO_NS)
+            return ns / repeticiones;
+        repeticiones = ns < 1e6 ? repeticiones * 10 : (size_t)(repeticiones * TIEMPO_MINIMO_NS * 1.2 / ns) + 1;
+    }
+}
+
+// Una fila de la tabla: elementos y bytes que procesa cada repeticion (bytes 0 si no aplica).
+template <typename Funcion>
+void reportar(const string &nombre, size_t peliculas, size_t elementos, size_t bytes, Funcion f) {
+    double ns = medir(f);
+    char linea[160];
+    if (bytes > 0)
+        snprintf(linea, sizeof(linea), "%-28s %8zu %14.0f %14.0f %10.1f\n", nombre.c_str(), peliculas, ns,
+                 elementos * 1e9 / ns, bytes * 1e3 / ns);
+    else
+        snprintf(linea, sizeof(linea), "%-28s %8zu %14.0f %14.0f %10s\n", nombre.c_str(), peliculas, ns,
+                 elementos * 1e9 / ns, "-");
+    cout << linea << flush;
+}
+
+// -------------------- CORPUS SINTETICO --------------------
+// Vocabulario de palabras inventadas con frecuencias de Zipf (como el lenguaje real) y un
+// conjunto chico de etiquetas; la misma semilla da siempre el mismo catalogo.
+struct Corpus {
+    vector<string> vocabulario;
+    vector<string> etiquetas;
+    vector<Pelicula> peliculas;
+    vector<string> lineasCSV;
+};
+
+string palabraAleatoria(mt19937 &gen) {
+    uniform_int_distribution<int> largo(3, 9), letra(0, 25);
+    string palabra(largo(gen), 'a');
+    for (char &c : palabra)
+        c = 'a' + letra(gen);
+    return palabra;
+}
+
+Corpus generarCorpus(size_t n) {
+    mt19937 gen(12345);
+    Corpus corpus;
+    for (int i = 0; i < 4000; i++)
+        corpus.vocabulario.push_back(palabraAleatoria(gen));
+    for (int i = 0; i < 60; i++)
+        corpus.etiquetas.push_back(palabraAleatoria(gen));
+    vector<double> pesos;
+    for (size_t r = 0; r < corpus.vocabulario.size(); r++)
+        pesos.push_back(1.0 / (r + 1));
+    discrete_distribution<int> zipf(pesos.begin(), pesos.end());
+    uniform_int_distribution<int> largoTitulo(1, 4), largoSinopsis(30, 70), numEtiquetas(1, 5);
+    uniform_int_distribution<int> etiqueta(0, corpus.etiquetas.size() - 1);
+    for (size_t i = 0; i < n; i++) {
+        Pelicula p;
+        char id[24];
+        snprintf(id, sizeof(id), "tt%07zu", i);
+        p.id = id;
+        for (int k = largoTitulo(gen); k > 0; k--) {
+            string palabra = corpus.vocabulario[zipf(gen)];
+            palabra[0] = toupper(palabra[0]);
+            p.titulo += (p.titulo.empty() ? "" : " ") + palabra;
+        }
+        for (int k = largoSinopsis(gen); k > 0; k--)
+            p.sinopsis += (p.sinopsis.empty() ? "" : (k % 12 == 0 ? ". " : " ")) + corpus.vocabulario[zipf(gen)];
+        p.sinopsis += ".";
+        set<int> elegidas;
+        for (int k = numEtiquetas(gen); k > 0; k--)
+            elegidas.insert(etiqueta(gen));
+        string columnaEtiquetas;
+        for (int e : elegidas) {
+            p.etiquetas.push_back(corpus.etiquetas[e]);
+            columnaEtiquetas += (columnaEtiquetas.empty() ? "" : ", ") + corpus.etiquetas[e];
+        }
+        p.fuente = "imdb";
+        corpus.lineasCSV.push_back(p.id + ",\"" + p.titulo + "\",\"" + p.sinopsis + "\",\"" + columnaEtiquetas +
+                                   "\",train," + p.fuente);
+        corpus.peliculas.push_back(move(p));
+    }
+    return corpus;
+}
+
+// Consultas de una o dos palabras del vocabulario (las frecuentes y las raras por igual).
+vector<string> generarConsultas(const Corpus &corpus, mt19937 &gen) {
+    uniform_int_distribution<int> palabra(0, corpus.vocabulario.size() - 1);
+    vector<string> consultas;
+    for (int i = 0; i < NUM_CONSULTAS; i++) {
+        string consulta = corpus.vocabulario[palabra(gen) % (i % 2 ? 50 : corpus.vocabulario.size())];
+        if (i % 4 == 3)
+            consulta += " " + corpus.vocabulario[palabra(gen) % 50];
+        consultas.push_back(consulta);
+    }
+    return consultas;
+}
+
+// -------------------- CASOS --------------------
+void ejecutarBenchmarks(size_t n) {
+    Corpus corpus = generarCorpus(n);
+    size_t bytesSinopsis = 0, bytesCSV = 0;
+    for (const Pelicula &p : corpus.peliculas)
+        bytesSinopsis += p.sinopsis.size();
+    for (const string &linea : corpus.lineasCSV)
+        bytesCSV += linea.size();
+
+    reportar("aMinusculas", n, n, bytesSinopsis, [&]() {
+        for (const Pelicula &p : corpus.peliculas)
+            sumidero += aMinusculas(p.sinopsis).size();
+    });
+    reportar("tokenizar", n, n, bytesSinopsis, [&]() {
+        for (const Pelicula &p : corpus.peliculas)
+            sumidero += tokenizar(p.sinopsis).size();
+    });
+    reportar("parsearLineaCSV", n, n, bytesCSV, [&]() {
+        for (const string &linea : corpus.lineasCSV)
+            sumidero += parsearLineaCSV(linea).size();
+    });
+    reportar("justificarTexto", n, n, bytesSinopsis, [&]() {
+        for (const Pelicula &p : corpus.peliculas)
+            sumidero += justificarTexto(p.sinopsis, ANCHO - 4).size();
+    });
+
+    vector<uint32_t> inicios;
+    size_t bytesTexto = construirTextoGlobal(corpus.peliculas, inicios).size();
+    reportar("ArbolSufijos: construir", n, n, bytesTexto, [&]() {
+        vector<uint32_t> inicioPeliculas;
+        string texto = construirTextoGlobal(corpus.peliculas, inicioPeliculas);
+        ArbolSufijosUkkonen arbol(move(texto), move(inicioPeliculas));
+        sumidero += arbol.numNodos;
+    });
+
+    InstantaneaCatalogo catalogo(1, make_shared<vector<Pelicula>>(corpus.peliculas));
+    mt19937 gen(777);
+    vector<string> consultas = generarConsultas(corpus, gen);
+    reportar("ArbolSufijos: buscar", n, consultas.size(), 0, [&]() {
+        for (const string &consulta : consultas)
+            sumidero += catalogo.arbol->buscar(consulta).size();
+    });
+
+    // Las dos estrategias del menu: titulo/sinopsis (candidatas del arbol, puntuadas en un hilo o en
+    // el pool) y etiqueta.
+    EstrategiaTituloSinopsis secuencial(catalogo.arbol.get(), false);
+    EstrategiaTituloSinopsis paralela(catalogo.arbol.get(), true);
+    EstrategiaEtiqueta porEtiqueta(catalogo.indiceEtiquetas);
+    reportar("TituloSinopsis (secuencial)", n, consultas.size(), 0, [&]() {
+        for (const string &consulta : consultas)
+            sumidero += secuencial.buscar(catalogo.peliculas, consulta).size();
+    });
+    reportar("TituloSinopsis (paralela)", n, consultas.size(), 0, [&]() {
+        for (const string &consulta : consultas)
+            sumidero += paralela.buscar(catalogo.peliculas, consulta).size();
+    });
+    uniform_int_distribution<int> etiqueta(0, corpus.etiquetas.size() - 1);
+    vector<string> consultasEtiqueta;
+    for (int i = 0; i < NUM_CONSULTAS; i++)
+        consultasEtiqueta.push_back(i % 2 ? corpus.etiquetas[etiqueta(gen)]
+                                          : corpus.etiquetas[etiqueta(gen)] + ", " + corpus.etiquetas[etiqueta(gen)]);
+    reportar("Etiqueta", n, consultasEtiqueta.size(), 0, [&]() {
+        for (const string &consulta : consultasEtiqueta)
+            sumidero += porEtiqueta.buscar(catalogo.peliculas, consulta).size();
+    });
+
+    vector<ListaUsuario> usuarios(NUM_USUARIOS);
+    uniform_int_distribution<int> pelicula(0, n - 1);
+    for (ListaUsuario &usuario : usuarios)
+        for (int k = 0; k < GUSTADAS_POR_USUARIO; k++)
+            usuario.agregar(pelicula(gen));
+    reportar("recomendarPeliculas", n, usuarios.size(), 0, [&]() {
+        for (const ListaUsuario &usuario : usuarios)
+            sumidero += recomendarPeliculas(catalogo.peliculas, usuario, &catalogo.popularidad).size();
+    });
+}
+
+int main(int argc, char* argv[]) {
+    vector<size_t> tamanos;
+    for (int i = 1; i < argc; i++)
+        if (atoi(argv[i]) > 0)
+            tamanos.push_back(atoi(argv[i]));
+    if (tamanos.empty())
+        tamanos = {1000, 4000, 16000};
+    cout << "Hilos del pool: " << PoolHilos::global().tamano() << endl;
+    char encabezado[160];
+    snprintf(encabezado, sizeof(encabezado), "%-28s %8s %14s %14s %10s\n", "Caso", "Pelic.", "ns/repeticion",
+             "elementos/s", "MB/s");
+    cout << encabezado;
+    for (size_t n : tamanos)
+        ejecutarBenchmarks(n);
+    cout << "Control: " << sumidero << endl;
+    return 0;
+}
@@ -5,11 +5,48 @@
 #include <string>
 #include <unordered_map>
 #include <set>
+#include <map>
 #include <algorithm>
+#include <numeric>
 #include <cctype>
 #include <limits>
 #include <future>
 #include <chrono>
+#include <cstdint>
+#include <thread>
+#include <mutex>
+#include <shared_mutex>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <atomic>
+#include <memory>
+#include <exception>
+#include <cstdlib>
+#include <queue>
+#include <cstdio>
+#include <cstring>
+#include <list>
+#include <tuple>
+#include <cmath>
+#include <coroutine>
+#include <optional>
+#include <utility>
+#include <bit>
+#ifndef _WIN32
+#include <cerrno>
+#include <csignal>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#endif
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
 
 using namespace std;
 
@@ -17,18 +54,261 @@ using namespace std;
 const int ANCHO = 80;           // Ancho para el recuadro de la sinopsis
 const int ANCHO_TITULO = 60;      // Ancho para justificar los titulos
 int modoBusquedaGlobal = 1;       // 1: Titulo y sinopsis, 2: Etiqueta
-const int NUM_HILOS = 4;        // Numero de hilos para busquedas paralelas (modificable manualmente)
+const int NUM_HILOS = 4;        // Hilos del pool si no se detecta la CPU ni se configura STREAMING_HILOS
+const int RESULTADOS_POR_PAGINA = 5;
+const int RECOMENDACIONES_POR_USUARIO = 5;  // Las del menu, el servidor y (por defecto) --recomendar-lote
+// Desde esta cantidad de candidatas se puntua en paralelo: puntuar copia y pasa a minusculas el
+// titulo y la sinopsis (del orden de un microsegundo por pelicula), asi que 4096 candidatas son
+// varios milisegundos, muy por encima del costo de repartir bloques en el pool.
+const size_t UMBRAL_BUSQUEDA_PARALELA = 4096;
+const size_t CAPACIDAD_CACHE_CONSULTAS = 64u << 20;  // Bytes maximos de la cache de resultados
+const float UMBRAL_CASI_DUPLICADO = 0.8f;  // Jaccard estimado desde el que dos sinopsis son la misma
 
 // -------------------- DECLARACION ANTICIPADA --------------------
 class ArbolSufijosUkkonen;   // Forward declaration
+struct InstantaneaCatalogo;
+class ContadoresPopularidad;
 
 // -------------------- ESTRUCTURA PELICULA --------------------
 struct Pelicula {
+    string id;         // imdb_id (columna 1 del CSV); identifica a la pelicula entre recargas
     string titulo;
     string sinopsis;
     vector<string> etiquetas;
     string fuente;     // Fuente de la sinopsis (columna 6 del CSV)
-    int likes = 0;     // 0 o 1; se permite un unico like.
+};
+
+// -------------------- ESTRUCTURA INDICE DE PALABRAS (POSICIONAL) --------------------
+// Para cada palabra se guarda la lista de peliculas (ordenada por indice) en las que aparece,
+// junto con las posiciones de token donde aparece. Las posiciones se guardan comprimidas:
+// diferencias entre posiciones consecutivas codificadas como varint (7 bits por byte), las de
+// todas las peliculas de la palabra seguidas en un unico buffer; cada posting guarda donde
+// empiezan las suyas (terminan donde empiezan las del siguiente).
+// Los tokens del titulo ocupan las posiciones 0..n-1 y los de la sinopsis empiezan en n+1,
+// de modo que una frase nunca cruza del titulo a la sinopsis.
+struct PostingPosicional {
+    int pelicula;                      // Indice de la pelicula en el vector de peliculas
+    uint32_t inicio;                   // Desplazamiento de sus posiciones en el buffer de la palabra
+};
+
+struct ListaPosicional {
+    vector<PostingPosicional> postings;
+    vector<unsigned char> posiciones;  // Posiciones de token de cada posting (delta + varint)
+
+    // Posiciones del posting i, decodificadas.
+    vector<int> posicionesDe(size_t i) const;
+};
+
+struct IndicePalabras {
+    unordered_map<string, ListaPosicional> postings;
+    vector<int> tokensTitulo;          // Cantidad de tokens del titulo de cada pelicula
+};
+
+// -------------------- ESTRUCTURA INDICE DE ETIQUETAS --------------------
+// Para cada etiqueta (en minusculas) se guarda la lista ordenada de peliculas que la tienen.
+// Ademas, cada etiqueta del vocabulario tiene un bitmap con un bit por pelicula, de modo que
+// las consultas por etiquetas se resuelven con AND/OR de bitmaps.
+struct IndiceEtiquetas {
+    unordered_map<string, vector<int>> postings;
+    vector<string> vocabulario;        // Etiquetas distintas; su posicion es el id de la etiqueta
+    size_t palabrasPorBitmap = 0;      // Palabras de 64 bits por bitmap
+    size_t numPeliculas = 0;
+    vector<uint64_t> bitmaps;          // vocabulario.size() bitmaps consecutivos
+    // Indice de trigramas sobre el vocabulario: trigrama -> ids de etiquetas (ordenados)
+    // que lo contienen. Permite resolver un fragmento a sus etiquetas sin recorrerlas todas.
+    unordered_map<uint32_t, vector<int>> trigramas;
+
+    const uint64_t* bitmap(int idEtiqueta) const {
+        return bitmaps.data() + idEtiqueta * palabrasPorBitmap;
+    }
+
+    static uint32_t claveTrigrama(const string &s, size_t pos) {
+        return ((uint32_t)(unsigned char)s[pos] << 16) |
+               ((uint32_t)(unsigned char)s[pos + 1] << 8) |
+               (uint32_t)(unsigned char)s[pos + 2];
+    }
+
+    // Id de una etiqueta exacta (en minusculas) o -1 si no esta en el vocabulario.
+    int idEtiqueta(const string &etiqueta) const {
+        auto it = lower_bound(vocabulario.begin(), vocabulario.end(), etiqueta);
+        return (it != vocabulario.end() && *it == etiqueta) ? it - vocabulario.begin() : -1;
+    }
+
+    // Ids de las etiquetas que contienen el fragmento como subcadena.
+    vector<int> etiquetasQueContienen(const string &fragmento) const {
+        vector<int> resultado;
+        if (fragmento.size() < 3) {
+            // Fragmentos muy cortos: no hay trigramas, se revisa el vocabulario directamente.
+            for (size_t id = 0; id < vocabulario.size(); id++)
+                if (vocabulario[id].find(fragmento) != string::npos)
+                    resultado.push_back(id);
+            return resultado;
+        }
+        // Interseccion de las listas de cada trigrama del fragmento, empezando por la mas corta.
+        vector<const vector<int>*> listas;
+        for (size_t i = 0; i + 3 <= fragmento.size(); i++) {
+            auto it = trigramas.find(claveTrigrama(fragmento, i));
+            if (it == trigramas.end())
+                return resultado;
+            listas.push_back(&it->second);
+        }
+        sort(listas.begin(), listas.end(), [](auto a, auto b){ return a->size() < b->size(); });
+        vector<int> candidatos = *listas[0];
+        for (size_t k = 1; k < listas.size() && !candidatos.empty(); k++) {
+            vector<int> interseccion;
+            set_intersection(candidatos.begin(), candidatos.end(), listas[k]->begin(), listas[k]->end(),
+                             back_inserter(interseccion));
+            candidatos.swap(interseccion);
+        }
+        // Los trigramas pueden coincidir sin que el fragmento este completo: se verifica.
+        for (int id : candidatos)
+            if (vocabulario[id].find(fragmento) != string::npos)
+                resultado.push_back(id);
+        return resultado;
+    }
+};
+
+// -------------------- ESTRUCTURA INDICE DE SIMILITUD (TF-IDF) --------------------
+// Cada sinopsis es un vector TF-IDF disperso (solo sus MAX_TERMINOS terminos de mas peso,
+// normalizado), guardado en formato CSR: el vector de la pelicula i ocupa [inicio[i], inicio[i+1])
+// de 'terminos' y 'pesos', con los terminos en orden creciente. Al construir el indice se calcula
+// tambien la tabla de K_VECINOS peliculas mas parecidas de cada una ("mas como esta").
+struct IndiceSimilitud {
+    static const int MAX_TERMINOS = 64;
+    static const int K_VECINOS = 10;
+    size_t numTerminos = 0;
+    vector<uint32_t> inicio;
+    vector<int> terminos;
+    vector<float> pesos;
+    vector<uint64_t> huellaTermino;    // Hash del texto de cada termino (no depende del orden de los ids)
+    vector<int> vecinos;               // K_VECINOS por pelicula, de mas a menos parecida (-1 si faltan)
+    vector<float> similitudVecinos;
+
+    size_t numPeliculas() const {
+        return inicio.empty() ? 0 : inicio.size() - 1;
+    }
+};
+
+// -------------------- ESTRUCTURA INDICE MINHASH (CASI DUPLICADOS) --------------------
+// Firma MinHash de cada sinopsis sobre sus shingles (TAM_SHINGLE palabras seguidas): la
+// fraccion de posiciones iguales entre dos firmas estima el Jaccard de sus shingles. La firma
+// se parte en BANDAS bandas de FILAS valores y dos peliculas con una banda identica caen en
+// el mismo balde (LSH), de modo que las parecidas se encuentran sin comparar todos los pares.
+struct IndiceMinHash {
+    static const int TAM_SHINGLE = 3;
+    static const int BANDAS = 32;
+    static const int FILAS = 4;
+    static const int LARGO_FIRMA = BANDAS * FILAS;
+    vector<uint32_t> firmas;                     // LARGO_FIRMA valores por pelicula
+    vector<unsigned char> conFirma;              // 0 si la sinopsis no tiene palabras
+    vector<vector<pair<uint64_t, int>>> baldes;  // Por banda: (clave de la banda, pelicula), ordenados
+
+    size_t numPeliculas() const {
+        return conFirma.size();
+    }
+};
+
+// -------------------- CONTABILIDAD DE MEMORIA --------------------
+// Cada estructura agrega al reporte una fila por parte (bytes de heap que ocupa y cuantos
+// elementos guarda). Los contenedores estandar se miden por su capacidad; donde la cuenta no se
+// puede deducir desde afuera (nodos y conjuntos del arbol de sufijos) se usa AsignadorContador,
+// que suma cada reserva real en un contador del dueno.
+struct FilaMemoria {
+    string estructura;
+    size_t bytes;
+    size_t elementos;
+};
+using ReporteMemoria = vector<FilaMemoria>;
+
+template <class T>
+struct AsignadorContador {
+    using value_type = T;
+    size_t* contador;
+
+    explicit AsignadorContador(size_t* contador) : contador(contador) {}
+    template <class U>
+    AsignadorContador(const AsignadorContador<U> &otro) : contador(otro.contador) {}
+
+    T* allocate(size_t n) {
+        *contador += n * sizeof(T);
+        return allocator<T>().allocate(n);
+    }
+    void deallocate(T* p, size_t n) {
+        *contador -= n * sizeof(T);
+        allocator<T>().deallocate(p, n);
+    }
+    template <class U>
+    bool operator==(const AsignadorContador<U> &otro) const { return contador == otro.contador; }
+};
+
+// Bytes de heap de un string (0 si cabe en el buffer interno).
+inline size_t memoriaCadena(const string &s) {
+    return s.capacity() > string().capacity() ? s.capacity() + 1 : 0;
+}
+
+template <class T>
+size_t memoriaVector(const vector<T> &v) {
+    return v.capacity() * sizeof(T);
+}
+
+// Tabla hash de libstdc++: arreglo de baldes + un nodo por entrada (siguiente, valor y, para
+// claves string, el hash guardado). No incluye la memoria propia de claves y valores.
+template <class Mapa>
+size_t memoriaTablaHash(const Mapa &m) {
+    return m.bucket_count() * sizeof(void*) + m.size() * (sizeof(typename Mapa::value_type) + 2 * sizeof(void*));
+}
+
+// -------------------- LISTAS DEL USUARIO --------------------
+// Lista de peliculas del usuario guardada por posicion en el catalogo: un registro con el orden
+// en que se agregaron (para mostrarla) y un bitset con un bit por pelicula, de modo que saber si
+// una pelicula esta en la lista es O(1). A diferencia de los punteros a Pelicula, se puede
+// guardar como imdb_ids (imdbIds) y rearmar sobre otra instantanea del catalogo.
+class ListaUsuario {
+private:
+    vector<int> orden;
+    vector<uint64_t> bits;
+public:
+    bool contiene(int pelicula) const {
+        return pelicula >= 0 && (size_t)pelicula / 64 < bits.size() && ((bits[pelicula / 64] >> (pelicula % 64)) & 1);
+    }
+    bool agregar(int pelicula) {
+        if (pelicula < 0 || contiene(pelicula))
+            return false;
+        if ((size_t)pelicula / 64 >= bits.size())
+            bits.resize(pelicula / 64 + 1, 0);
+        bits[pelicula / 64] |= 1ULL << (pelicula % 64);
+        orden.push_back(pelicula);
+        return true;
+    }
+    bool quitar(int pelicula) {
+        if (!contiene(pelicula))
+            return false;
+        bits[pelicula / 64] &= ~(1ULL << (pelicula % 64));
+        orden.erase(find(orden.begin(), orden.end(), pelicula));
+        return true;
+    }
+    // Agrega o quita la pelicula; devuelve true si quedo en la lista.
+    bool alternar(int pelicula) {
+        return quitar(pelicula) ? false : agregar(pelicula);
+    }
+    const vector<int>& ids() const {
+        return orden;
+    }
+    bool vacia() const {
+        return orden.empty();
+    }
+    vector<Pelicula*> punteros(vector<Pelicula> &peliculas) const {
+        vector<Pelicula*> salida;
+        for (int pelicula : orden)
+            salida.push_back(&peliculas[pelicula]);
+        return salida;
+    }
+    vector<string> imdbIds(const vector<Pelicula> &peliculas) const {
+        vector<string> salida;
+        for (int pelicula : orden)
+            salida.push_back(peliculas[pelicula].id);
+        return salida;
+    }
 };
 
 // -------------------- DECLARACIONES DE FUNCIONES AUXILIARES --------------------
@@ -45,19 +325,31 @@ string extraerFragmento(const string &sinopsis, const string &consulta);
 
 // -------------------- DECLARACIONES DE FUNCIONES DE CARGA E INDICES --------------------
 vector<Pelicula> cargarPeliculas(const string &nombreArchivo);
-unordered_map<string, set<Pelicula*>> construirIndice(const vector<Pelicula>& peliculas);
-unordered_map<string, set<Pelicula*>> construirIndiceEtiquetas(const vector<Pelicula>& peliculas);
-vector<Pelicula*> recomendarPeliculas(const vector<Pelicula>& peliculas, const vector<Pelicula*>& gustadas);
+IndicePalabras construirIndice(const vector<Pelicula>& peliculas);
+void codificarPosiciones(const vector<int> &posiciones, vector<unsigned char> &salida);
+vector<int> decodificarPosiciones(const unsigned char* inicio, const unsigned char* fin);
+vector<int> decodificarPosiciones(const vector<unsigned char> &codificadas);
+IndiceEtiquetas construirIndiceEtiquetas(const vector<Pelicula>& peliculas);
+template<typename Funcion> void paraCadaBloque(size_t total, size_t numBloques, Funcion funcion);
+void andBitmap(uint64_t* destino, const uint64_t* fuente, size_t palabras);
+void orBitmap(uint64_t* destino, const uint64_t* fuente, size_t palabras);
+IndiceMinHash construirIndiceMinHash(const vector<Pelicula>& peliculas);
+float jaccardEstimado(const IndiceMinHash &indice, int a, int b);
+IndiceSimilitud construirIndiceSimilitud(const vector<Pelicula>& peliculas, const IndiceMinHash* minhash = nullptr);
+float productoDispersoDenso(const int* terminos, const float* pesos, size_t n, const float* denso);
+uint64_t huellaBytes(const void* datos, size_t n);
+uint64_t mezclarBits(uint64_t x);
+vector<Pelicula*> recomendarPeliculas(const vector<Pelicula>& peliculas, const ListaUsuario& gustadas,
+                                      const ContadoresPopularidad* popularidad = nullptr);
 
 // -------------------- DECLARACIONES DE FUNCIONES DE IMPRESION Y MENU --------------------
 void mostrarListaTitulos(const vector<Pelicula*>& lista);
-bool submenuPelicula(Pelicula* seleccionada, vector<Pelicula*>& gustadas, vector<Pelicula*>& verMasTarde);
-void manejarLista(const vector<Pelicula*>& lista, const string &nombreLista, vector<Pelicula*>& gustadas, vector<Pelicula*>& verMasTarde);
-void manejarBusqueda(vector<Pelicula>& peliculas,
-                     unordered_map<string, set<Pelicula*>> &indiceModo1,
-                     unordered_map<string, set<Pelicula*>> &indiceEtiqueta,
-                     vector<Pelicula*>& gustadas,
-                     vector<Pelicula*>& verMasTarde);
+bool submenuPelicula(Pelicula* seleccionada, ListaUsuario& gustadas, ListaUsuario& verMasTarde);
+bool manejarLista(const vector<Pelicula*>& lista, const string &nombreLista, ListaUsuario& gustadas, ListaUsuario& verMasTarde);
+void manejarBusqueda(InstantaneaCatalogo &catalogo,
+                     ListaUsuario& gustadas,
+                     ListaUsuario& verMasTarde);
+void manejarAutocompletado(const string &prefijo, ListaUsuario& gustadas, ListaUsuario& verMasTarde);
 void manejarHistorialBusquedas();
 
 // -------------------- PATRON MEMENTO: HISTORIAL DE BUSQUEDAS --------------------
@@ -102,27 +394,591 @@ CuidadorHistorialBusquedas cuidadorHistorial;
 
 // -------------------- PATRON SINGLETON: BASE DE DATOS (TEMPLATE) --------------------
 // Ahora, la clase BaseDeDatos es genérica y puede usarse para cualquier tipo T.
+// La creacion de la instancia es segura entre hilos. Los datos se comparten con shared_ptr para
+// que recargar() pueda leer una version nueva del archivo mientras la anterior sigue en uso
+// (por ejemplo, dentro de una instantanea del catalogo que aun se esta consultando).
 template<typename T>
 class BaseDeDatos {
 private:
     static BaseDeDatos<T>* instancia;
-    vector<T> datos;
-    BaseDeDatos(const string &archivo, vector<T> (*cargarFuncion)(const string &)) {
-        datos = cargarFuncion(archivo);
+    static mutex mutexInstancia;
+    string archivo;
+    vector<T> (*cargarFuncion)(const string &);
+    shared_ptr<vector<T>> datos;
+    mutex mutexDatos;
+    BaseDeDatos(const string &archivo, vector<T> (*cargarFuncion)(const string &))
+      : archivo(archivo), cargarFuncion(cargarFuncion) {
+        datos = make_shared<vector<T>>(cargarFuncion(archivo));
     }
 public:
     static BaseDeDatos<T>* obtenerInstancia(const string &archivo, vector<T> (*cargarFuncion)(const string &)) {
+        lock_guard<mutex> lk(mutexInstancia);
         if (!instancia)
             instancia = new BaseDeDatos<T>(archivo, cargarFuncion);
         return instancia;
     }
+    // Version actual de los datos. Tras una recarga, la referencia sigue apuntando a la version
+    // anterior solo mientras alguien la comparta: para consultas concurrentes usar compartirDatos().
     vector<T>& obtenerDatos() {
+        lock_guard<mutex> lk(mutexDatos);
+        return *datos;
+    }
+    shared_ptr<vector<T>> compartirDatos() {
+        lock_guard<mutex> lk(mutexDatos);
         return datos;
     }
+    // Vuelve a leer el archivo y pasa a usar la version nueva.
+    shared_ptr<vector<T>> recargar() {
+        auto nuevos = make_shared<vector<T>>(cargarFuncion(archivo));
+        lock_guard<mutex> lk(mutexDatos);
+        datos = nuevos;
+        return nuevos;
+    }
 };
 
 template<typename T>
 BaseDeDatos<T>* BaseDeDatos<T>::instancia = nullptr;
+template<typename T>
+mutex BaseDeDatos<T>::mutexInstancia;
+
+// -------------------- POOL DE HILOS CON ROBO DE TAREAS --------------------
+// Pool unico para todo el proceso. Cada hilo tiene su propia cola: toma tareas del final de la
+// suya y, si esta vacia, roba del inicio de las colas de los demas. Asi las rutas paralelas
+// envian tareas pequenas sin pagar la creacion y destruccion de hilos en cada consulta.
+class PoolHilos {
+private:
+    struct Cola {
+        mutex m;
+        deque<function<void()>> tareas;
+    };
+    vector<unique_ptr<Cola>> colas;
+    vector<thread> hilos;
+    atomic<bool> detener{false};
+    atomic<size_t> siguienteCola{0};
+    atomic<size_t> pendientes{0};
+    mutex mEspera;
+    condition_variable cvEspera;
+
+    static int& indiceHiloActual() {
+        static thread_local int indice = -1;   // -1: el hilo no pertenece al pool
+        return indice;
+    }
+
+    bool tomarTarea(function<void()> &tarea) {
+        int propio = indiceHiloActual();
+        if (propio >= 0) {
+            Cola &cola = *colas[propio];
+            lock_guard<mutex> lk(cola.m);
+            if (!cola.tareas.empty()) {
+                tarea = move(cola.tareas.back());
+                cola.tareas.pop_back();
+                pendientes--;
+                return true;
+            }
+        }
+        size_t n = colas.size();
+        size_t inicio = (propio >= 0) ? propio + 1 : siguienteCola.load();
+        for (size_t k = 0; k < n; k++) {
+            Cola &cola = *colas[(inicio + k) % n];
+            lock_guard<mutex> lk(cola.m);
+            if (!cola.tareas.empty()) {
+                tarea = move(cola.tareas.front());
+                cola.tareas.pop_front();
+                pendientes--;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void bucleTrabajador(int indice) {
+        indiceHiloActual() = indice;
+        while (true) {
+            function<void()> tarea;
+            if (tomarTarea(tarea)) {
+                tarea();
+                continue;
+            }
+            unique_lock<mutex> lk(mEspera);
+            cvEspera.wait(lk, [this]{ return detener.load() || pendientes.load() > 0; });
+            if (detener.load() && pendientes.load() == 0)
+                return;
+        }
+    }
+
+    void encolar(function<void()> tarea) {
+        int propio = indiceHiloActual();
+        size_t destino = (propio >= 0) ? propio : siguienteCola++ % colas.size();
+        {
+            // Se cuenta bajo el candado de la cola, antes de que otro hilo pueda tomarla.
+            lock_guard<mutex> lk(colas[destino]->m);
+            pendientes++;
+            colas[destino]->tareas.push_back(move(tarea));
+        }
+        { lock_guard<mutex> lk(mEspera); }
+        cvEspera.notify_one();
+    }
+
+public:
+    explicit PoolHilos(size_t numHilos) {
+        numHilos = max<size_t>(numHilos, 1);
+        for (size_t i = 0; i < numHilos; i++)
+            colas.push_back(make_unique<Cola>());
+        for (size_t i = 0; i < numHilos; i++)
+            hilos.emplace_back(&PoolHilos::bucleTrabajador, this, (int)i);
+    }
+
+    ~PoolHilos() {
+        {
+            lock_guard<mutex> lk(mEspera);
+            detener = true;
+        }
+        cvEspera.notify_all();
+        for (auto &h : hilos)
+            h.join();
+    }
+
+    // Tamano configurado: variable de entorno STREAMING_HILOS, o los nucleos de la CPU.
+    static size_t hilosConfigurados() {
+        const char* valor = getenv("STREAMING_HILOS");
+        if (valor != nullptr && atoi(valor) > 0)
+            return atoi(valor);
+        unsigned int nucleos = thread::hardware_concurrency();
+        return nucleos > 0 ? nucleos : NUM_HILOS;
+    }
+
+    static PoolHilos& global() {
+        static PoolHilos pool(hilosConfigurados());
+        return pool;
+    }
+
+    size_t tamano() const {
+        return hilos.size();
+    }
+
+    template<typename Funcion>
+    auto enviar(Funcion funcion) -> future<decltype(funcion())> {
+        using Resultado = decltype(funcion());
+        auto tarea = make_shared<packaged_task<Resultado()>>(move(funcion));
+        future<Resultado> fut = tarea->get_future();
+        encolar([tarea]() { (*tarea)(); });
+        return fut;
+    }
+
+    // Encola una tarea sin future (las corrutinas la usan para reanudarse en el pool).
+    void lanzar(function<void()> tarea) {
+        encolar(move(tarea));
+    }
+
+    // Ejecuta una tarea pendiente en el hilo que llama (para ayudar mientras espera).
+    bool ejecutarPendiente() {
+        function<void()> tarea;
+        if (!tomarTarea(tarea))
+            return false;
+        tarea();
+        return true;
+    }
+
+    // Espera hasta que listo() sea verdadero y, mientras tanto, ejecuta tareas del pool (asi se
+    // puede llamar desde un hilo del pool sin bloquearlo). Quien hace verdadero listo() debe llamar
+    // despues a avisar().
+    template<typename Condicion>
+    void esperarAyudando(Condicion listo) {
+        while (!listo()) {
+            if (ejecutarPendiente())
+                continue;
+            unique_lock<mutex> lk(mEspera);
+            cvEspera.wait(lk, [&]{ return listo() || pendientes.load() > 0; });
+        }
+        // Si este hilo consumio el aviso de una tarea nueva sin tomarla, se lo pasa a otro.
+        if (pendientes.load() > 0)
+            cvEspera.notify_one();
+    }
+
+    void avisar() {
+        { lock_guard<mutex> lk(mEspera); }
+        cvEspera.notify_all();
+    }
+
+    // Divide [0, total) en numBloques bloques contiguos, ejecuta funcion(inicio, fin, bloque) en el
+    // pool y espera a que terminen. Mientras espera, el hilo que llama tambien ejecuta tareas,
+    // por lo que se puede usar desde dentro de otra tarea del pool sin bloquearlo.
+    template<typename Funcion>
+    void paraCadaBloque(size_t total, size_t numBloques, Funcion funcion) {
+        numBloques = max<size_t>(numBloques, 1);
+        size_t tamBloque = total / numBloques;
+        atomic<size_t> restantes{numBloques};
+        mutex mError;
+        exception_ptr error;
+        for (size_t i = 0; i < numBloques; i++) {
+            size_t inicio = i * tamBloque;
+            size_t fin = (i == numBloques - 1) ? total : (i + 1) * tamBloque;
+            encolar([&, inicio, fin, i]() {
+                exception_ptr errorLocal;
+                try {
+                    funcion(inicio, fin, i);
+                } catch (...) {
+                    errorLocal = current_exception();
+                }
+                if (errorLocal) {
+                    lock_guard<mutex> lk(mError);
+                    if (!error)
+                        error = errorLocal;
+                }
+                if (restantes.fetch_sub(1) == 1)
+                    avisar();
+            });
+        }
+        esperarAyudando([&]{ return restantes.load() == 0; });
+        if (error)
+            rethrow_exception(error);
+    }
+};
+
+// -------------------- CORRUTINAS SOBRE EL POOL --------------------
+// Tarea<T> es una corrutina perezosa: no corre hasta que alguien la espera con co_await (o con
+// esperar()). Al terminar reanuda directamente a quien la esperaba. Con "co_await cambiarAlPool()"
+// una etapa se suspende y sigue en un hilo del pool, asi muchas consultas en curso se reparten
+// entre pocos hilos sin que ninguno quede bloqueado esperando a otro.
+template<typename T>
+class Tarea {
+public:
+    struct promise_type {
+        optional<T> valor;
+        exception_ptr error;
+        coroutine_handle<> continuacion;
+
+        Tarea get_return_object() { return Tarea(coroutine_handle<promise_type>::from_promise(*this)); }
+        suspend_always initial_suspend() noexcept { return {}; }
+        struct AlTerminar {
+            bool await_ready() noexcept { return false; }
+            coroutine_handle<> await_suspend(coroutine_handle<promise_type> h) noexcept {
+                coroutine_handle<> c = h.promise().continuacion;
+                return c ? c : noop_coroutine();
+            }
+            void await_resume() noexcept {}
+        };
+        AlTerminar final_suspend() noexcept { return {}; }
+        void return_value(T v) { valor = move(v); }
+        void unhandled_exception() { error = current_exception(); }
+    };
+
+    Tarea(Tarea &&otra) noexcept : h(std::exchange(otra.h, nullptr)) {}
+    Tarea& operator=(Tarea &&otra) noexcept {
+        if (this != &otra) {
+            if (h)
+                h.destroy();
+            h = std::exchange(otra.h, nullptr);
+        }
+        return *this;
+    }
+    Tarea(const Tarea&) = delete;
+    Tarea& operator=(const Tarea&) = delete;
+    ~Tarea() {
+        if (h)
+            h.destroy();
+    }
+
+    bool await_ready() const noexcept { return false; }
+    coroutine_handle<> await_suspend(coroutine_handle<> quienEspera) noexcept {
+        h.promise().continuacion = quienEspera;
+        return h;
+    }
+    T await_resume() {
+        if (h.promise().error)
+            rethrow_exception(h.promise().error);
+        return move(*h.promise().valor);
+    }
+
+private:
+    explicit Tarea(coroutine_handle<promise_type> h) : h(h) {}
+    coroutine_handle<promise_type> h;
+};
+
+// Corrutina que arranca de inmediato y se libera sola al terminar (solo para uso interno).
+struct TareaDesacoplada {
+    struct promise_type {
+        TareaDesacoplada get_return_object() { return {}; }
+        suspend_never initial_suspend() noexcept { return {}; }
+        suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { terminate(); }
+    };
+};
+
+// co_await cambiarAlPool(): la corrutina continua en un hilo del pool global.
+inline auto cambiarAlPool() {
+    struct Cambio {
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(coroutine_handle<> h) const { PoolHilos::global().lanzar([h]() { h.resume(); }); }
+        void await_resume() const noexcept {}
+    };
+    return Cambio{};
+}
+
+template<typename T>
+struct EstadoEspera {
+    optional<T> valor;
+    exception_ptr error;
+    atomic<bool> listo{false};
+};
+
+template<typename T>
+TareaDesacoplada conducirYAvisar(Tarea<T> &tarea, EstadoEspera<T> &estado) {
+    try {
+        estado.valor = co_await tarea;
+    } catch (...) {
+        estado.error = current_exception();
+    }
+    estado.listo = true;
+    PoolHilos::global().avisar();
+}
+
+// Espera de forma sincronica a una tarea. Igual que paraCadaBloque, mientras espera ejecuta
+// tareas del pool, por lo que tambien se puede llamar desde un hilo del pool.
+template<typename T>
+T esperar(Tarea<T> tarea) {
+    EstadoEspera<T> estado;
+    conducirYAvisar(tarea, estado);
+    PoolHilos::global().esperarAyudando([&]{ return estado.listo.load(); });
+    if (estado.error)
+        rethrow_exception(estado.error);
+    return move(*estado.valor);
+}
+
+// co_await esperarTodas(tareas): lanza todas las tareas a la vez y reanuda a quien espera cuando
+// termina la ultima (en el hilo de esa ultima). Devuelve los resultados en el mismo orden.
+template<typename T>
+class EsperaGrupo {
+private:
+    vector<Tarea<T>> tareas;
+    vector<optional<T>> valores;
+    vector<exception_ptr> errores;
+    atomic<size_t> restantes{0};
+    coroutine_handle<> continuacion;
+
+    static TareaDesacoplada conducir(EsperaGrupo &grupo, size_t i) {
+        try {
+            Tarea<T> &tarea = grupo.tareas[i];
+            grupo.valores[i] = co_await tarea;
+        } catch (...) {
+            grupo.errores[i] = current_exception();
+        }
+        if (grupo.restantes.fetch_sub(1, memory_order_acq_rel) == 1)
+            grupo.continuacion.resume();
+    }
+
+public:
+    explicit EsperaGrupo(vector<Tarea<T>> t) : tareas(move(t)), valores(tareas.size()), errores(tareas.size()) {}
+
+    bool await_ready() const noexcept { return tareas.empty(); }
+    bool await_suspend(coroutine_handle<> h) {
+        continuacion = h;
+        restantes = tareas.size() + 1;   // +1: este hilo tambien cuenta hasta terminar de lanzar
+        for (size_t i = 0; i < tareas.size(); i++)
+            conducir(*this, i);
+        return restantes.fetch_sub(1, memory_order_acq_rel) != 1;
+    }
+    vector<T> await_resume() {
+        vector<T> salida;
+        salida.reserve(valores.size());
+        for (size_t i = 0; i < valores.size(); i++) {
+            if (errores[i])
+                rethrow_exception(errores[i]);
+            salida.push_back(move(*valores[i]));
+        }
+        return salida;
+    }
+};
+
+template<typename T>
+EsperaGrupo<T> esperarTodas(vector<Tarea<T>> tareas) {
+    return EsperaGrupo<T>(move(tareas));
+}
+
+// -------------------- CONTADORES DE POPULARIDAD --------------------
+// Un solo hilo de fondo para todo el proceso: cada PERIODO_CONSOLIDACION consolida todos los
+// ContadoresPopularidad vivos (cada instantanea del catalogo tiene los suyos).
+class ConsolidadorPopularidad {
+private:
+    static constexpr chrono::milliseconds PERIODO_CONSOLIDACION{500};
+    mutex m;
+    condition_variable cv;
+    bool detener = false;
+    vector<ContadoresPopularidad*> registrados;   // Protegido por m
+    thread hilo;
+
+    void bucle();
+public:
+    ConsolidadorPopularidad() : hilo(&ConsolidadorPopularidad::bucle, this) {}
+    ~ConsolidadorPopularidad() {
+        {
+            lock_guard<mutex> lk(m);
+            detener = true;
+        }
+        cv.notify_all();
+        hilo.join();
+    }
+
+    static ConsolidadorPopularidad& global() {
+        static ConsolidadorPopularidad consolidador;
+        return consolidador;
+    }
+
+    void registrar(ContadoresPopularidad* contadores) {
+        lock_guard<mutex> lk(m);
+        registrados.push_back(contadores);
+    }
+
+    // Al volver, el hilo de fondo ya no esta consolidando esos contadores.
+    void quitar(ContadoresPopularidad* contadores) {
+        lock_guard<mutex> lk(m);
+        registrados.erase(remove(registrados.begin(), registrados.end(), contadores), registrados.end());
+    }
+};
+
+// Likes y vistas acumulados por pelicula. Cada hilo suma en uno de NUM_FRAGMENTOS arreglos de
+// deltas (asignado por turno la primera vez que el hilo escribe), asi las peliculas mas
+// populares no concentran todas las escrituras en una misma linea de cache. El consolidador
+// pasa los deltas a los totales; solo recorre los bloques de 64 peliculas marcados como sucios.
+// Leer un total es una carga atomica (puede ir con retraso).
+class ContadoresPopularidad {
+public:
+    static const int NUM_FRAGMENTOS = 16;
+    static const int PESO_LIKE = 10;   // Un like vale como diez vistas en la puntuacion
+private:
+    struct alignas(64) Fragmento {
+        unique_ptr<atomic<int32_t>[]> likes;
+        unique_ptr<atomic<int32_t>[]> vistas;
+        unique_ptr<atomic<uint64_t>[]> sucios;   // 1 bit por bloque de 64 peliculas
+    };
+    size_t numPeliculas;
+    size_t palabrasSucias;
+    vector<Fragmento> fragmentos;
+    unique_ptr<atomic<int64_t>[]> totalLikes;
+    unique_ptr<atomic<int64_t>[]> totalVistas;
+    mutex mutexConsolidar;
+    function<void(const vector<int>&)> alConsolidar;   // Protegido por mutexConsolidar
+
+    static int fragmentoDelHilo() {
+        static atomic<int> siguiente{0};
+        thread_local int fragmento = siguiente.fetch_add(1, memory_order_relaxed) % NUM_FRAGMENTOS;
+        return fragmento;
+    }
+
+    void sumar(size_t pelicula, int delta, bool esLike) {
+        if (pelicula >= numPeliculas || delta == 0)
+            return;
+        Fragmento &f = fragmentos[fragmentoDelHilo()];
+        (esLike ? f.likes : f.vistas)[pelicula].fetch_add(delta, memory_order_relaxed);
+        // Marcar despues de sumar: si consolidar ya limpio el bit, el delta se vera en la proxima.
+        size_t bloque = pelicula / 64;
+        uint64_t bit = 1ULL << (bloque % 64);
+        atomic<uint64_t> &palabra = f.sucios[bloque / 64];
+        if (!(palabra.load(memory_order_relaxed) & bit))
+            palabra.fetch_or(bit, memory_order_release);
+    }
+
+public:
+    explicit ContadoresPopularidad(size_t n)
+      : numPeliculas(n), palabrasSucias((n + 64 * 64 - 1) / (64 * 64)), fragmentos(NUM_FRAGMENTOS) {
+        for (Fragmento &f : fragmentos) {
+            f.likes = make_unique<atomic<int32_t>[]>(n);
+            f.vistas = make_unique<atomic<int32_t>[]>(n);
+            f.sucios = make_unique<atomic<uint64_t>[]>(palabrasSucias);
+        }
+        totalLikes = make_unique<atomic<int64_t>[]>(n);
+        totalVistas = make_unique<atomic<int64_t>[]>(n);
+        ConsolidadorPopularidad::global().registrar(this);
+    }
+
+    ~ContadoresPopularidad() {
+        ConsolidadorPopularidad::global().quitar(this);
+    }
+
+    ContadoresPopularidad(const ContadoresPopularidad&) = delete;
+    ContadoresPopularidad& operator=(const ContadoresPopularidad&) = delete;
+
+    void sumarLike(size_t pelicula, int delta) { sumar(pelicula, delta, true); }
+    void sumarVista(size_t pelicula) { sumar(pelicula, 1, false); }
+
+    // Funcion a llamar con las peliculas cuyos totales cambiaron en cada consolidacion (por
+    // ejemplo, para reordenar el autocompletado). Con nullptr se deja de llamar; al volver, ya no
+    // hay ninguna llamada en curso.
+    void observarConsolidacion(function<void(const vector<int>&)> funcion) {
+        lock_guard<mutex> lk(mutexConsolidar);
+        alConsolidar = move(funcion);
+    }
+
+    // Pasa los deltas de todos los fragmentos a los totales. Se puede llamar a mano para que un
+    // cambio se vea de inmediato (el modo interactivo lo hace despues de cada like).
+    void consolidar() {
+        lock_guard<mutex> lk(mutexConsolidar);
+        vector<int> cambiadas;
+        for (Fragmento &f : fragmentos) {
+            for (size_t w = 0; w < palabrasSucias; w++) {
+                uint64_t bits = f.sucios[w].exchange(0, memory_order_acquire);
+                while (bits) {
+                    size_t bloque = w * 64 + countr_zero(bits);
+                    bits &= bits - 1;
+                    size_t fin = min(numPeliculas, (bloque + 1) * 64);
+                    for (size_t i = bloque * 64; i < fin; i++) {
+                        int32_t dl = f.likes[i].exchange(0, memory_order_relaxed);
+                        int32_t dv = f.vistas[i].exchange(0, memory_order_relaxed);
+                        if (dl)
+                            totalLikes[i].fetch_add(dl, memory_order_relaxed);
+                        if (dv)
+                            totalVistas[i].fetch_add(dv, memory_order_relaxed);
+                        if (dl || dv)
+                            cambiadas.push_back(i);
+                    }
+                }
+            }
+        }
+        if (alConsolidar && !cambiadas.empty())
+            alConsolidar(cambiadas);
+    }
+
+    // Fija los totales de una pelicula (al pasar los contadores a una instantanea nueva).
+    void fijar(size_t pelicula, int64_t likes, int64_t vistas) {
+        if (pelicula >= numPeliculas)
+            return;
+        totalLikes[pelicula].store(likes, memory_order_relaxed);
+        totalVistas[pelicula].store(vistas, memory_order_relaxed);
+    }
+
+    // Suma directamente a los totales de una pelicula (al ponerse al dia con otra instantanea).
+    void sumarTotales(size_t pelicula, int64_t likes, int64_t vistas) {
+        if (pelicula >= numPeliculas)
+            return;
+        totalLikes[pelicula].fetch_add(likes, memory_order_relaxed);
+        totalVistas[pelicula].fetch_add(vistas, memory_order_relaxed);
+    }
+
+    size_t tamano() const { return numPeliculas; }
+    void reportarMemoria(ReporteMemoria &reporte) const {
+        // Por fragmento: likes y vistas (int32) mas el bitmap de bloques sucios; luego los totales.
+        size_t porFragmento = numPeliculas * 2 * sizeof(int32_t) + palabrasSucias * sizeof(uint64_t);
+        reporte.push_back({"Popularidad: fragmentos", NUM_FRAGMENTOS * porFragmento, NUM_FRAGMENTOS * numPeliculas * 2});
+        reporte.push_back({"Popularidad: totales", numPeliculas * 2 * sizeof(int64_t), numPeliculas * 2});
+    }
+    int64_t likes(size_t pelicula) const {
+        return pelicula < numPeliculas ? totalLikes[pelicula].load(memory_order_relaxed) : 0;
+    }
+    int64_t vistas(size_t pelicula) const {
+        return pelicula < numPeliculas ? totalVistas[pelicula].load(memory_order_relaxed) : 0;
+    }
+    int64_t puntuacion(size_t pelicula) const {
+        return likes(pelicula) * PESO_LIKE + vistas(pelicula);
+    }
+};
+
+void ConsolidadorPopularidad::bucle() {
+    unique_lock<mutex> lk(m);
+    while (!cv.wait_for(lk, PERIODO_CONSOLIDACION, [this]{ return detener; }))
+        for (ContadoresPopularidad* contadores : registrados)
+            contadores->consolidar();
+}
 
 // -------------------- FUNCIONES AUXILIARES --------------------
 string aMinusculas(const string &s) {
@@ -294,6 +1150,7 @@ vector<Pelicula> cargarPeliculas(const string &nombreArchivo) {
         if (campos.size() < 6)
             continue;
         Pelicula p;
+        p.id = campos[0];
         p.titulo = campos[1];
         p.sinopsis = campos[2];
         {
@@ -312,88 +1169,1384 @@ vector<Pelicula> cargarPeliculas(const string &nombreArchivo) {
     return peliculas;
 }
 
-unordered_map<string, set<Pelicula*>> construirIndice(const vector<Pelicula>& peliculas) {
-    unordered_map<string, set<Pelicula*>> indice;
-    for (auto &pelicula : peliculas) {
-        vector<string> tokensTitulo = tokenizar(pelicula.titulo);
-        vector<string> tokensSinopsis = tokenizar(pelicula.sinopsis);
-        for (auto &palabra : tokensTitulo)
-            indice[palabra].insert(const_cast<Pelicula*>(&pelicula));
-        for (auto &palabra : tokensSinopsis)
-            indice[palabra].insert(const_cast<Pelicula*>(&pelicula));
+void codificarPosiciones(const vector<int> &posiciones, vector<unsigned char> &salida) {
+    int anterior = 0;
+    for (int pos : posiciones) {
+        unsigned int delta = pos - anterior;
+        anterior = pos;
+        while (delta >= 0x80) {
+            salida.push_back(static_cast<unsigned char>(delta | 0x80));
+            delta >>= 7;
+        }
+        salida.push_back(static_cast<unsigned char>(delta));
     }
-    return indice;
 }
 
-unordered_map<string, set<Pelicula*>> construirIndiceEtiquetas(const vector<Pelicula>& peliculas) {
-    unordered_map<string, set<Pelicula*>> indiceEtiquetas;
-    for (auto &pelicula : peliculas) {
-        for (auto &etiqueta : pelicula.etiquetas) {
-            string etiquetaLower = aMinusculas(etiqueta);
-            indiceEtiquetas[etiquetaLower].insert(const_cast<Pelicula*>(&pelicula));
+vector<int> decodificarPosiciones(const unsigned char* inicio, const unsigned char* fin) {
+    vector<int> posiciones;
+    int actual = 0;
+    unsigned int delta = 0;
+    int desplazamiento = 0;
+    for (const unsigned char* p = inicio; p != fin; p++) {
+        unsigned char byte = *p;
+        delta |= (unsigned int)(byte & 0x7F) << desplazamiento;
+        if (byte & 0x80) {
+            desplazamiento += 7;
+        } else {
+            actual += delta;
+            posiciones.push_back(actual);
+            delta = 0;
+            desplazamiento = 0;
         }
     }
-    return indiceEtiquetas;
+    return posiciones;
 }
 
-vector<Pelicula*> recomendarPeliculas(const vector<Pelicula>& peliculas, const vector<Pelicula*>& gustadas) {
-    set<string> etiquetasGustadas;
-    for (auto pelicula : gustadas)
-        for (auto &etiqueta : pelicula->etiquetas)
-            etiquetasGustadas.insert(etiqueta);
-    vector<pair<Pelicula*, int>> puntajes;
-    for (auto &pelicula : peliculas) {
-        bool yaGustada = false;
-        for (auto pelGustada : gustadas) {
-            if (pelGustada == &pelicula) {
-                yaGustada = true;
-                break;
+vector<int> decodificarPosiciones(const vector<unsigned char> &codificadas) {
+    return decodificarPosiciones(codificadas.data(), codificadas.data() + codificadas.size());
+}
+
+vector<int> ListaPosicional::posicionesDe(size_t i) const {
+    size_t fin = (i + 1 < postings.size()) ? postings[i + 1].inicio : posiciones.size();
+    return decodificarPosiciones(posiciones.data() + postings[i].inicio, posiciones.data() + fin);
+}
+
+// Atajo para repartir un rango entre los hilos del pool global.
+template<typename Funcion>
+void paraCadaBloque(size_t total, size_t numBloques, Funcion funcion) {
+    PoolHilos::global().paraCadaBloque(total, numBloques, funcion);
+}
+
+// Cada bloque del pool construye un indice parcial para su rango de peliculas. Como los bloques son
+// disjuntos y estan en orden, al fusionar basta con concatenar las listas de cada palabra.
+IndicePalabras construirIndice(const vector<Pelicula>& peliculas) {
+    IndicePalabras indice;
+    indice.tokensTitulo.resize(peliculas.size());
+    size_t numBloques = PoolHilos::global().tamano();
+    vector<unordered_map<string, ListaPosicional>> parciales(numBloques);
+    paraCadaBloque(peliculas.size(), numBloques, [&](size_t inicio, size_t fin, size_t bloque) {
+        auto &parcial = parciales[bloque];
+        for (size_t i = inicio; i < fin; i++) {
+            vector<string> tokensTitulo = tokenizar(peliculas[i].titulo);
+            vector<string> tokensSinopsis = tokenizar(peliculas[i].sinopsis);
+            indice.tokensTitulo[i] = tokensTitulo.size();
+            // Posiciones de cada palabra dentro de esta pelicula (ya quedan en orden creciente)
+            unordered_map<string, vector<int>> posicionesLocales;
+            int pos = 0;
+            for (auto &palabra : tokensTitulo)
+                posicionesLocales[palabra].push_back(pos++);
+            pos++; // Hueco entre titulo y sinopsis
+            for (auto &palabra : tokensSinopsis)
+                posicionesLocales[palabra].push_back(pos++);
+            for (auto &par : posicionesLocales) {
+                ListaPosicional &lista = parcial[par.first];
+                lista.postings.push_back({(int)i, (uint32_t)lista.posiciones.size()});
+                codificarPosiciones(par.second, lista.posiciones);
             }
         }
-        if (yaGustada)
-            continue;
-        int puntaje = 0;
-        for (auto &etiqueta : pelicula.etiquetas)
-            if (etiquetasGustadas.count(etiqueta))
-                puntaje++;
-        if (puntaje > 0)
-            puntajes.push_back(make_pair(const_cast<Pelicula*>(&pelicula), puntaje));
+    });
+    for (auto &parcial : parciales) {
+        for (auto &par : parcial) {
+            ListaPosicional &destino = indice.postings[par.first];
+            if (destino.postings.empty()) {
+                destino = move(par.second);
+            } else {
+                // Los desplazamientos del bloque pasan a contar desde el final del buffer acumulado.
+                uint32_t base = destino.posiciones.size();
+                for (PostingPosicional &posting : par.second.postings)
+                    destino.postings.push_back({posting.pelicula, posting.inicio + base});
+                destino.posiciones.insert(destino.posiciones.end(), par.second.posiciones.begin(),
+                                          par.second.posiciones.end());
+            }
+        }
+        parcial.clear();
     }
-    sort(puntajes.begin(), puntajes.end(), [](auto &a, auto &b){ return a.second > b.second; });
-    vector<Pelicula*> recomendadas;
-    for (size_t i = 0; i < puntajes.size() && i < 5; i++)
-        recomendadas.push_back(puntajes[i].first);
-    return recomendadas;
+    return indice;
 }
 
-// -------------------- ARBOL DE SUFIJOS CON ALGORITMO DE UKKONEN --------------------
-// Nota: Esta implementacion es una version simplificada.
-class ArbolSufijosUkkonen {
-public:
-    struct Nodo {
-        unordered_map<char, Nodo*> hijos;
-        int inicio;
-        int* fin;
-        Nodo* enlaceSufijo;
-        set<int> indicesPeliculas;
-        int indiceSufijo;
-        Nodo(int inicio, int* fin) : inicio(inicio), fin(fin), enlaceSufijo(nullptr), indiceSufijo(-1) {}
-    };
-
-    string texto;
-    Nodo* raiz;
+IndiceEtiquetas construirIndiceEtiquetas(const vector<Pelicula>& peliculas) {
+    IndiceEtiquetas indiceEtiquetas;
+    size_t numBloques = PoolHilos::global().tamano();
+    vector<unordered_map<string, vector<int>>> parciales(numBloques);
+    paraCadaBloque(peliculas.size(), numBloques, [&](size_t inicio, size_t fin, size_t bloque) {
+        auto &parcial = parciales[bloque];
+        for (size_t i = inicio; i < fin; i++) {
+            for (auto &etiqueta : peliculas[i].etiquetas) {
+                vector<int> &lista = parcial[aMinusculas(etiqueta)];
+                if (lista.empty() || lista.back() != (int)i)
+                    lista.push_back(i);
+            }
+        }
+    });
+    for (auto &parcial : parciales) {
+        for (auto &par : parcial) {
+            vector<int> &destino = indiceEtiquetas.postings[par.first];
+            destino.insert(destino.end(), par.second.begin(), par.second.end());
+        }
+        parcial.clear();
+    }
+    // Bitmaps por etiqueta a partir de las listas ya fusionadas
+    indiceEtiquetas.numPeliculas = peliculas.size();
+    indiceEtiquetas.palabrasPorBitmap = (peliculas.size() + 63) / 64;
+    for (auto &par : indiceEtiquetas.postings)
+        indiceEtiquetas.vocabulario.push_back(par.first);
+    sort(indiceEtiquetas.vocabulario.begin(), indiceEtiquetas.vocabulario.end());
+    indiceEtiquetas.bitmaps.assign(indiceEtiquetas.vocabulario.size() * indiceEtiquetas.palabrasPorBitmap, 0);
+    for (size_t id = 0; id < indiceEtiquetas.vocabulario.size(); id++) {
+        uint64_t* bits = indiceEtiquetas.bitmaps.data() + id * indiceEtiquetas.palabrasPorBitmap;
+        for (int pel : indiceEtiquetas.postings[indiceEtiquetas.vocabulario[id]])
+            bits[pel / 64] |= (uint64_t)1 << (pel % 64);
+        const string &etiqueta = indiceEtiquetas.vocabulario[id];
+        for (size_t i = 0; i + 3 <= etiqueta.size(); i++) {
+            vector<int> &lista = indiceEtiquetas.trigramas[IndiceEtiquetas::claveTrigrama(etiqueta, i)];
+            if (lista.empty() || lista.back() != (int)id)
+                lista.push_back(id);
+        }
+    }
+    return indiceEtiquetas;
+}
+
+// Operaciones sobre bitmaps: con AVX2 se procesan 256 bits por instruccion; sin AVX2 el
+// compilador vectoriza igualmente el bucle de 64 bits.
+void andBitmap(uint64_t* destino, const uint64_t* fuente, size_t palabras) {
+    size_t i = 0;
+#if defined(__AVX2__)
+    for (; i + 4 <= palabras; i += 4) {
+        __m256i a = _mm256_loadu_si256((const __m256i*)(destino + i));
+        __m256i b = _mm256_loadu_si256((const __m256i*)(fuente + i));
+        _mm256_storeu_si256((__m256i*)(destino + i), _mm256_and_si256(a, b));
+    }
+#endif
+    for (; i < palabras; i++)
+        destino[i] &= fuente[i];
+}
+
+void orBitmap(uint64_t* destino, const uint64_t* fuente, size_t palabras) {
+    size_t i = 0;
+#if defined(__AVX2__)
+    for (; i + 4 <= palabras; i += 4) {
+        __m256i a = _mm256_loadu_si256((const __m256i*)(destino + i));
+        __m256i b = _mm256_loadu_si256((const __m256i*)(fuente + i));
+        _mm256_storeu_si256((__m256i*)(destino + i), _mm256_or_si256(a, b));
+    }
+#endif
+    for (; i < palabras; i++)
+        destino[i] |= fuente[i];
+}
+
+// Hash FNV-1a de 64 bits de un bloque de memoria.
+uint64_t huellaBytes(const void* datos, size_t n) {
+    const unsigned char* bytes = (const unsigned char*)datos;
+    uint64_t h = 1469598103934665603ULL;
+    for (size_t i = 0; i < n; i++)
+        h = (h ^ bytes[i]) * 1099511628211ULL;
+    return h;
+}
+
+// Mezcla de splitmix64: convierte una clave en 64 bits de apariencia aleatoria.
+uint64_t mezclarBits(uint64_t x) {
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+// Producto punto entre un vector disperso (terminos, pesos) y uno denso. Con AVX2 se leen 8
+// posiciones del vector denso por instruccion (gather); sin AVX2 queda el bucle escalar.
+float productoDispersoDenso(const int* terminos, const float* pesos, size_t n, const float* denso) {
+    size_t i = 0;
+    float suma = 0;
+#if defined(__AVX2__)
+    __m256 acumulado = _mm256_setzero_ps();
+    for (; i + 8 <= n; i += 8) {
+        __m256i indices = _mm256_loadu_si256((const __m256i*)(terminos + i));
+        __m256 valores = _mm256_i32gather_ps(denso, indices, 4);
+        acumulado = _mm256_add_ps(acumulado, _mm256_mul_ps(_mm256_loadu_ps(pesos + i), valores));
+    }
+    float partes[8];
+    _mm256_storeu_ps(partes, acumulado);
+    for (float parte : partes)
+        suma += parte;
+#endif
+    for (; i < n; i++)
+        suma += pesos[i] * denso[terminos[i]];
+    return suma;
+}
+
+// Firmas MinHash y baldes LSH. Cada permutacion es h(x) = (a * x + b) >> 32 sobre el hash de
+// 64 bits del shingle. Las firmas se calculan en paralelo por peliculas y los baldes por bandas.
+IndiceMinHash construirIndiceMinHash(const vector<Pelicula>& peliculas) {
+    const int L = IndiceMinHash::LARGO_FIRMA;
+    IndiceMinHash indice;
+    size_t n = peliculas.size();
+    indice.firmas.assign(n * L, UINT32_MAX);
+    indice.conFirma.assign(n, 0);
+    uint64_t a[L], b[L];
+    for (int p = 0; p < L; p++) {
+        a[p] = mezclarBits(p) | 1;
+        b[p] = mezclarBits(p + L);
+    }
+    PoolHilos &pool = PoolHilos::global();
+    paraCadaBloque(n, pool.tamano() * 4, [&](size_t desde, size_t hasta, size_t) {
+        for (size_t i = desde; i < hasta; i++) {
+            vector<string> tokens = tokenizar(peliculas[i].sinopsis);
+            if (tokens.empty())
+                continue;
+            uint32_t* firma = &indice.firmas[i * L];
+            size_t pasos = tokens.size() >= (size_t)IndiceMinHash::TAM_SHINGLE
+                               ? tokens.size() - IndiceMinHash::TAM_SHINGLE + 1 : 1;
+            string shingle;
+            for (size_t s = 0; s < pasos; s++) {
+                shingle = tokens[s];
+                for (size_t k = 1; k < (size_t)IndiceMinHash::TAM_SHINGLE && s + k < tokens.size(); k++)
+                    shingle += " " + tokens[s + k];
+                uint64_t x = huellaBytes(shingle.data(), shingle.size());
+                for (int p = 0; p < L; p++)
+                    firma[p] = min(firma[p], (uint32_t)((a[p] * x + b[p]) >> 32));
+            }
+            indice.conFirma[i] = 1;
+        }
+    });
+    indice.baldes.resize(IndiceMinHash::BANDAS);
+    paraCadaBloque(IndiceMinHash::BANDAS, IndiceMinHash::BANDAS, [&](size_t desde, size_t hasta, size_t) {
+        for (size_t banda = desde; banda < hasta; banda++) {
+            vector<pair<uint64_t, int>> &baldes = indice.baldes[banda];
+            for (size_t i = 0; i < n; i++)
+                if (indice.conFirma[i])
+                    baldes.push_back(make_pair(huellaBytes(&indice.firmas[i * L + banda * IndiceMinHash::FILAS],
+                                                           IndiceMinHash::FILAS * sizeof(uint32_t)), (int)i));
+            sort(baldes.begin(), baldes.end());
+        }
+    });
+    return indice;
+}
+
+// Jaccard estimado entre las sinopsis de dos peliculas (0 si alguna no tiene firma).
+float jaccardEstimado(const IndiceMinHash &indice, int a, int b) {
+    if (!indice.conFirma[a] || !indice.conFirma[b])
+        return 0;
+    const uint32_t* fa = &indice.firmas[(size_t)a * IndiceMinHash::LARGO_FIRMA];
+    const uint32_t* fb = &indice.firmas[(size_t)b * IndiceMinHash::LARGO_FIRMA];
+    int iguales = 0;
+    for (int p = 0; p < IndiceMinHash::LARGO_FIRMA; p++)
+        iguales += fa[p] == fb[p];
+    return (float)iguales / IndiceMinHash::LARGO_FIRMA;
+}
+
+// Peliculas que comparten al menos un balde con la dada (sin ella misma), ordenadas por indice.
+vector<int> candidatosLSH(const IndiceMinHash &indice, int pelicula) {
+    vector<int> candidatas;
+    if (pelicula < 0 || pelicula >= (int)indice.numPeliculas() || !indice.conFirma[pelicula])
+        return candidatas;
+    for (int banda = 0; banda < IndiceMinHash::BANDAS; banda++) {
+        const vector<pair<uint64_t, int>> &baldes = indice.baldes[banda];
+        uint64_t clave = huellaBytes(&indice.firmas[(size_t)pelicula * IndiceMinHash::LARGO_FIRMA + banda * IndiceMinHash::FILAS],
+                                     IndiceMinHash::FILAS * sizeof(uint32_t));
+        for (auto it = lower_bound(baldes.begin(), baldes.end(), make_pair(clave, numeric_limits<int>::min()));
+             it != baldes.end() && it->first == clave; ++it)
+            if (it->second != pelicula)
+                candidatas.push_back(it->second);
+    }
+    sort(candidatas.begin(), candidatas.end());
+    candidatas.erase(unique(candidatas.begin(), candidatas.end()), candidatas.end());
+    return candidatas;
+}
+
+// Grupos de casi duplicados de todo el catalogo: se unen (union-find) los pares que comparten
+// un balde y cuyo Jaccard estimado llega al umbral. Solo se devuelven grupos de 2 o mas
+// peliculas, cada uno ordenado y los grupos por su primera pelicula.
+vector<vector<int>> agruparCasiDuplicados(const IndiceMinHash &indice, float umbral) {
+    size_t n = indice.numPeliculas();
+    vector<int> padre(n);
+    for (size_t i = 0; i < n; i++)
+        padre[i] = i;
+    auto raiz = [&](int x) {
+        while (padre[x] != x)
+            x = padre[x] = padre[padre[x]];
+        return x;
+    };
+    for (const vector<pair<uint64_t, int>> &baldes : indice.baldes) {
+        for (size_t inicio = 0, fin; inicio < baldes.size(); inicio = fin) {
+            for (fin = inicio + 1; fin < baldes.size() && baldes[fin].first == baldes[inicio].first; fin++) {}
+            for (size_t j = inicio + 1; j < fin; j++)
+                for (size_t i = inicio; i < j; i++) {
+                    int a = raiz(baldes[i].second), b = raiz(baldes[j].second);
+                    if (a != b && jaccardEstimado(indice, baldes[i].second, baldes[j].second) >= umbral)
+                        padre[max(a, b)] = min(a, b);
+                }
+        }
+    }
+    vector<vector<int>> porRaiz(n);
+    for (size_t i = 0; i < n; i++)
+        porRaiz[raiz(i)].push_back(i);
+    vector<vector<int>> grupos;
+    for (auto &grupo : porRaiz)
+        if (grupo.size() > 1)
+            grupos.push_back(move(grupo));
+    return grupos;
+}
+
+// Construye los vectores TF-IDF (tf = 1 + log(frecuencia), idf = log(N / df)) y la tabla kNN.
+// Los terminos que aparecen en mas de la mitad de las sinopsis se descartan (no distinguen).
+// Para los vecinos de cada pelicula se juntan como candidatas hasta MAX_CANDIDATOS peliculas: primero
+// las de sus baldes LSH (si se pasa el indice MinHash) y luego las que comparten sus terminos,
+// empezando por los de mas peso en esa pelicula; a cada candidata se le calcula el coseno exacto con
+// productoDispersoDenso. Con MinHash, ademas, la tabla no guarda casi duplicados de la pelicula ni
+// dos vecinas casi duplicadas entre si. Todas las etapas por pelicula corren en el pool.
+IndiceSimilitud construirIndiceSimilitud(const vector<Pelicula>& peliculas, const IndiceMinHash* minhash) {
+    const size_t MAX_CANDIDATOS = 512;
+    IndiceSimilitud indice;
+    size_t n = peliculas.size();
+    PoolHilos &pool = PoolHilos::global();
+    size_t numBloques = pool.tamano();
+
+    // 1. Frecuencia de cada termino por pelicula y vocabulario parcial por bloque.
+    vector<vector<pair<string, int>>> frecuencias(n);
+    vector<unordered_map<string, int>> dfParciales(numBloques);
+    paraCadaBloque(n, numBloques, [&](size_t desde, size_t hasta, size_t bloque) {
+        for (size_t i = desde; i < hasta; i++) {
+            unordered_map<string, int> tf;
+            for (string &token : tokenizar(peliculas[i].sinopsis))
+                tf[token]++;
+            for (auto &par : tf)
+                dfParciales[bloque][par.first]++;
+            frecuencias[i].assign(tf.begin(), tf.end());
+        }
+    });
+    // 2. Vocabulario global y df. Los ids siguen el orden alfabetico de los terminos, asi no
+    // dependen de cuantos bloques (hilos) hubo ni del orden de las tablas hash.
+    unordered_map<string, int> dfTermino;
+    for (auto &parcial : dfParciales) {
+        for (auto &par : parcial)
+            dfTermino[par.first] += par.second;
+        parcial.clear();
+    }
+    vector<string> vocabulario;
+    vocabulario.reserve(dfTermino.size());
+    for (auto &par : dfTermino)
+        vocabulario.push_back(par.first);
+    sort(vocabulario.begin(), vocabulario.end());
+    unordered_map<string, int> idTermino;
+    idTermino.reserve(vocabulario.size());
+    vector<int> df(vocabulario.size());
+    for (size_t t = 0; t < vocabulario.size(); t++) {
+        idTermino.emplace(vocabulario[t], (int)t);
+        df[t] = dfTermino[vocabulario[t]];
+    }
+    indice.numTerminos = df.size();
+    indice.huellaTermino.resize(df.size());
+    for (auto &par : idTermino)
+        indice.huellaTermino[par.second] = huellaBytes(par.first.data(), par.first.size());
+    // 3. Pesos, recorte a MAX_TERMINOS y normalizacion.
+    vector<vector<pair<int, float>>> vectores(n);
+    paraCadaBloque(n, numBloques, [&](size_t desde, size_t hasta, size_t) {
+        for (size_t i = desde; i < hasta; i++) {
+            vector<pair<int, float>> &v = vectores[i];
+            for (auto &[termino, tf] : frecuencias[i]) {
+                int id = idTermino.at(termino);
+                if (df[id] * 2 > (int)n)
+                    continue;
+                v.push_back(make_pair(id, (float)((1.0 + log((double)tf)) * log((double)n / df[id]))));
+            }
+            if (v.size() > (size_t)IndiceSimilitud::MAX_TERMINOS) {
+                // A igual peso gana el termino de id menor: el recorte no depende del orden de entrada.
+                nth_element(v.begin(), v.begin() + IndiceSimilitud::MAX_TERMINOS, v.end(),
+                            [](auto &a, auto &b){ return a.second > b.second || (a.second == b.second && a.first < b.first); });
+                v.resize(IndiceSimilitud::MAX_TERMINOS);
+            }
+            sort(v.begin(), v.end());
+            double norma = 0;
+            for (auto &par : v)
+                norma += (double)par.second * par.second;
+            norma = sqrt(norma);
+            for (auto &par : v)
+                par.second = norma > 0 ? par.second / norma : 0;
+            vector<pair<string, int>>().swap(frecuencias[i]);
+        }
+    });
+    indice.inicio.assign(n + 1, 0);
+    for (size_t i = 0; i < n; i++)
+        indice.inicio[i + 1] = indice.inicio[i] + vectores[i].size();
+    indice.terminos.resize(indice.inicio[n]);
+    indice.pesos.resize(indice.inicio[n]);
+    for (size_t i = 0; i < n; i++)
+        for (size_t k = 0; k < vectores[i].size(); k++) {
+            indice.terminos[indice.inicio[i] + k] = vectores[i][k].first;
+            indice.pesos[indice.inicio[i] + k] = vectores[i][k].second;
+        }
+    // 4. Listas invertidas termino -> peliculas (solo para generar candidatas).
+    vector<uint32_t> inicioLista(indice.numTerminos + 1, 0);
+    for (int t : indice.terminos)
+        inicioLista[t + 1]++;
+    for (size_t t = 0; t < indice.numTerminos; t++)
+        inicioLista[t + 1] += inicioLista[t];
+    vector<int> listas(indice.terminos.size());
+    vector<uint32_t> llenado(inicioLista.begin(), inicioLista.end() - 1);
+    for (size_t i = 0; i < n; i++)
+        for (uint32_t k = indice.inicio[i]; k < indice.inicio[i + 1]; k++)
+            listas[llenado[indice.terminos[k]]++] = i;
+    // 5. Tabla kNN.
+    const int K = IndiceSimilitud::K_VECINOS;
+    indice.vecinos.assign(n * K, -1);
+    indice.similitudVecinos.assign(n * K, 0);
+    paraCadaBloque(n, numBloques * 4, [&](size_t desde, size_t hasta, size_t) {
+        vector<float> denso(indice.numTerminos, 0);
+        vector<int> marca(n, -1);
+        vector<int> candidatas;
+        vector<pair<float, int>> porPeso;
+        vector<pair<float, int>> puntajes;
+        for (size_t i = desde; i < hasta; i++) {
+            uint32_t a = indice.inicio[i], b = indice.inicio[i + 1];
+            porPeso.clear();
+            for (uint32_t k = a; k < b; k++) {
+                denso[indice.terminos[k]] = indice.pesos[k];
+                int t = indice.terminos[k];
+                porPeso.push_back(make_pair(-indice.pesos[k], t));
+            }
+            sort(porPeso.begin(), porPeso.end());
+            candidatas.clear();
+            marca[i] = i;
+            if (minhash)
+                for (int j : candidatosLSH(*minhash, i)) {
+                    if (candidatas.size() >= MAX_CANDIDATOS)
+                        break;
+                    marca[j] = i;
+                    candidatas.push_back(j);
+                }
+            for (auto &[peso, t] : porPeso) {
+                for (uint32_t k = inicioLista[t]; k < inicioLista[t + 1] && candidatas.size() < MAX_CANDIDATOS; k++) {
+                    int j = listas[k];
+                    if (marca[j] != (int)i) {
+                        marca[j] = i;
+                        candidatas.push_back(j);
+                    }
+                }
+                if (candidatas.size() >= MAX_CANDIDATOS)
+                    break;
+            }
+            puntajes.clear();
+            for (int j : candidatas) {
+                uint32_t c = indice.inicio[j], d = indice.inicio[j + 1];
+                float similitud = productoDispersoDenso(&indice.terminos[c], &indice.pesos[c], d - c, denso.data());
+                if (similitud > 0)
+                    puntajes.push_back(make_pair(-similitud, j));
+            }
+            sort(puntajes.begin(), puntajes.end());
+            size_t elegidos = 0;
+            for (size_t k = 0; k < puntajes.size() && elegidos < (size_t)K; k++) {
+                int j = puntajes[k].second;
+                if (minhash) {
+                    bool repetida = jaccardEstimado(*minhash, i, j) >= UMBRAL_CASI_DUPLICADO;
+                    for (size_t e = 0; e < elegidos && !repetida; e++)
+                        repetida = jaccardEstimado(*minhash, indice.vecinos[i * K + e], j) >= UMBRAL_CASI_DUPLICADO;
+                    if (repetida)
+                        continue;
+                }
+                indice.vecinos[i * K + elegidos] = j;
+                indice.similitudVecinos[i * K + elegidos] = -puntajes[k].first;
+                elegidos++;
+            }
+            for (uint32_t k = a; k < b; k++)
+                denso[indice.terminos[k]] = 0;
+        }
+    });
+    return indice;
+}
+
+// Peliculas de la tabla kNN para "mas como esta", de mas a menos parecida.
+vector<int> peliculasSimilares(const IndiceSimilitud &indice, int pelicula) {
+    vector<int> salida;
+    if (pelicula < 0 || pelicula >= (int)indice.numPeliculas())
+        return salida;
+    for (int k = 0; k < IndiceSimilitud::K_VECINOS; k++) {
+        int vecino = indice.vecinos[pelicula * IndiceSimilitud::K_VECINOS + k];
+        if (vecino != -1)
+            salida.push_back(vecino);
+    }
+    return salida;
+}
+
+// -------------------- INDICE HNSW (VECINOS APROXIMADOS) --------------------
+// Cada pelicula tiene ademas un vector denso de IndiceHNSW::DIMENSION floats: la proyeccion
+// aleatoria de su vector TF-IDF mas la de sus etiquetas (one-hot). Cada termino o etiqueta suma
+// su peso con signos +-1 que salen del hash de su texto, asi que la matriz de proyeccion no se
+// guarda. Sobre esos vectores (normalizados) se arma un grafo HNSW: varias capas de grafos de
+// proximidad, cada una con menos nodos que la anterior, que se recorren de arriba hacia abajo
+// acercandose a la consulta. Responde "los k mas parecidos" sin recorrer todo el catalogo.
+string archivoIndiceHNSW;   // Si no esta vacio, el grafo se lee de este archivo o se guarda en el
+
+// Producto punto entre dos vectores densos. Con AVX2 se procesan 8 floats por instruccion.
+float productoPunto(const float* a, const float* b, size_t n) {
+    size_t i = 0;
+    float suma = 0;
+#if defined(__AVX2__)
+    __m256 acumulado = _mm256_setzero_ps();
+    for (; i + 8 <= n; i += 8) {
+#if defined(__FMA__)
+        acumulado = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acumulado);
+#else
+        acumulado = _mm256_add_ps(acumulado, _mm256_mul_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i)));
+#endif
+    }
+    float partes[8];
+    _mm256_storeu_ps(partes, acumulado);
+    for (float parte : partes)
+        suma += parte;
+#endif
+    for (; i < n; i++)
+        suma += a[i] * b[i];
+    return suma;
+}
+
+class IndiceHNSW {
+public:
+    static const int DIMENSION = 64;
+    static const int M = 16;                 // Vecinos por nodo en las capas superiores
+    static const int M0 = 2 * M;             // Vecinos por nodo en la capa 0
+    static const int EF_CONSTRUCCION = 100;
+    static const int EF_BUSQUEDA = 64;
+private:
+    static const uint64_t MAGIA = 0x31574e5348ULL;   // "HNSW1"
+    size_t n = 0;
+    vector<float> vectores;                  // n * DIMENSION
+    vector<int> nivel;                       // Capa mas alta de cada nodo
+    vector<int> enlacesBase;                 // Capa 0: n bloques de (cantidad, M0 ids)
+    vector<vector<int>> enlacesSuperiores;   // Capas 1..nivel: nivel bloques de (cantidad, M ids)
+    int entrada = -1;
+    int nivelMaximo = -1;
+    // Solo durante la construccion: un candado por nodo para sus listas y otro para la entrada.
+    unique_ptr<mutex[]> candados;
+    mutex mutexEntrada;
+    bool construyendo = false;
+
+    const float* vectorDe(int nodo) const {
+        return &vectores[(size_t)nodo * DIMENSION];
+    }
+    float distancia(const float* consulta, int nodo) const {
+        return 1.0f - productoPunto(consulta, vectorDe(nodo), DIMENSION);
+    }
+    int* enlaces(int nodo, int capa) {
+        return capa == 0 ? &enlacesBase[(size_t)nodo * (M0 + 1)] : &enlacesSuperiores[nodo][(capa - 1) * (M + 1)];
+    }
+    const int* enlaces(int nodo, int capa) const {
+        return const_cast<IndiceHNSW*>(this)->enlaces(nodo, capa);
+    }
+    void copiarEnlaces(int nodo, int capa, vector<int> &salida) const {
+        unique_lock<mutex> candado;
+        if (construyendo)
+            candado = unique_lock<mutex>(candados[nodo]);
+        const int* lista = enlaces(nodo, capa);
+        salida.assign(lista + 1, lista + 1 + lista[0]);
+    }
+    // Nivel de cada nodo con distribucion geometrica (1/M de los nodos sube cada capa); depende
+    // solo del indice, asi que dos construcciones del mismo catalogo tienen las mismas capas.
+    static int nivelAleatorio(size_t nodo) {
+        double u = ((mezclarBits(nodo ^ MAGIA) >> 11) + 1) * 0x1.0p-53;
+        return min(30, (int)(-log(u) / log((double)M)));
+    }
+
+    int codicioso(const float* consulta, int actual, int capa) const {
+        float mejor = distancia(consulta, actual);
+        vector<int> lista;
+        for (bool mejoro = true; mejoro; ) {
+            mejoro = false;
+            copiarEnlaces(actual, capa, lista);
+            for (int vecino : lista) {
+                float d = distancia(consulta, vecino);
+                if (d < mejor) {
+                    mejor = d;
+                    actual = vecino;
+                    mejoro = true;
+                }
+            }
+        }
+        return actual;
+    }
+
+    // Busqueda en una capa: los ef nodos mas cercanos alcanzables desde 'inicio', ordenados.
+    vector<pair<float, int>> buscarEnCapa(const float* consulta, int inicio, int ef, int capa) const {
+        thread_local vector<uint32_t> visitados;
+        thread_local uint32_t sello = 0;
+        if (visitados.size() < n)
+            visitados.resize(n, 0);
+        if (++sello == 0) {
+            fill(visitados.begin(), visitados.end(), 0);
+            sello = 1;
+        }
+        priority_queue<pair<float, int>, vector<pair<float, int>>, greater<pair<float, int>>> candidatos;
+        priority_queue<pair<float, int>> resultados;
+        float d = distancia(consulta, inicio);
+        candidatos.push(make_pair(d, inicio));
+        resultados.push(make_pair(d, inicio));
+        visitados[inicio] = sello;
+        vector<int> lista;
+        while (!candidatos.empty()) {
+            auto [dc, c] = candidatos.top();
+            if (dc > resultados.top().first && resultados.size() >= (size_t)ef)
+                break;
+            candidatos.pop();
+            copiarEnlaces(c, capa, lista);
+            for (int vecino : lista) {
+                if (visitados[vecino] == sello)
+                    continue;
+                visitados[vecino] = sello;
+                float dv = distancia(consulta, vecino);
+                if (resultados.size() < (size_t)ef || dv < resultados.top().first) {
+                    candidatos.push(make_pair(dv, vecino));
+                    resultados.push(make_pair(dv, vecino));
+                    if (resultados.size() > (size_t)ef)
+                        resultados.pop();
+                }
+            }
+        }
+        vector<pair<float, int>> salida(resultados.size());
+        for (size_t i = salida.size(); i-- > 0; resultados.pop())
+            salida[i] = resultados.top();
+        return salida;
+    }
+
+    // Heuristica de HNSW: de los candidatos (ordenados por distancia) se queda con uno solo si
+    // esta mas cerca del nodo que de los ya elegidos, para que los enlaces cubran direcciones
+    // distintas en vez de amontonarse en un mismo grupo.
+    vector<int> seleccionarVecinos(const vector<pair<float, int>> &candidatos, int m) const {
+        vector<int> elegidos;
+        for (auto &[d, c] : candidatos) {
+            if ((int)elegidos.size() >= m)
+                break;
+            bool diverso = true;
+            for (int otro : elegidos)
+                if (distancia(vectorDe(c), otro) < d) {
+                    diverso = false;
+                    break;
+                }
+            if (diverso)
+                elegidos.push_back(c);
+        }
+        return elegidos;
+    }
+
+    void agregarEnlace(int nodo, int nuevo, int capa) {
+        lock_guard<mutex> candado(candados[nodo]);
+        int* lista = enlaces(nodo, capa);
+        int capacidad = capa == 0 ? M0 : M;
+        if (lista[0] < capacidad) {
+            lista[1 + lista[0]++] = nuevo;
+            return;
+        }
+        vector<pair<float, int>> candidatos;
+        candidatos.push_back(make_pair(distancia(vectorDe(nodo), nuevo), nuevo));
+        for (int k = 1; k <= lista[0]; k++)
+            candidatos.push_back(make_pair(distancia(vectorDe(nodo), lista[k]), lista[k]));
+        sort(candidatos.begin(), candidatos.end());
+        vector<int> elegidos = seleccionarVecinos(candidatos, capacidad);
+        lista[0] = elegidos.size();
+        copy(elegidos.begin(), elegidos.end(), lista + 1);
+    }
+
+    void insertar(int nodo) {
+        int nivelNodo = nivel[nodo];
+        // Si el nodo sube mas alto que la entrada actual, se retiene el candado hasta
+        // convertirlo en la nueva entrada.
+        unique_lock<mutex> candadoEntrada(mutexEntrada);
+        int actual = entrada, tope = nivelMaximo;
+        if (nivelNodo <= tope)
+            candadoEntrada.unlock();
+        const float* v = vectorDe(nodo);
+        for (int capa = tope; capa > nivelNodo; capa--)
+            actual = codicioso(v, actual, capa);
+        for (int capa = min(nivelNodo, tope); capa >= 0; capa--) {
+            vector<pair<float, int>> cercanos = buscarEnCapa(v, actual, EF_CONSTRUCCION, capa);
+            vector<int> vecinos = seleccionarVecinos(cercanos, M);
+            {
+                lock_guard<mutex> candado(candados[nodo]);
+                int* lista = enlaces(nodo, capa);
+                lista[0] = vecinos.size();
+                copy(vecinos.begin(), vecinos.end(), lista + 1);
+            }
+            for (int vecino : vecinos)
+                agregarEnlace(vecino, nodo, capa);
+            actual = cercanos[0].second;
+        }
+        if (nivelNodo > tope) {
+            entrada = nodo;
+            nivelMaximo = nivelNodo;
+        }
+    }
+
+public:
+    size_t tamano() const {
+        return n;
+    }
+    const float* vectorPelicula(int pelicula) const {
+        return vectorDe(pelicula);
+    }
+    void reportarMemoria(ReporteMemoria &reporte) const {
+        reporte.push_back({"HNSW: vectores", memoriaVector(vectores), vectores.size()});
+        size_t bytesEnlaces = memoriaVector(nivel) + memoriaVector(enlacesBase) + memoriaVector(enlacesSuperiores);
+        size_t enlacesTotales = 0;
+        for (size_t i = 0; i < n; i++) {
+            enlacesTotales += enlaces(i, 0)[0];
+            bytesEnlaces += memoriaVector(enlacesSuperiores[i]);
+            for (int capa = 1; capa <= nivel[i]; capa++)
+                enlacesTotales += enlaces(i, capa)[0];
+        }
+        reporte.push_back({"HNSW: enlaces", bytesEnlaces, enlacesTotales});
+    }
+
+    // Inserta todos los nodos en paralelo en el pool (el primero queda como entrada).
+    void construir(vector<float> v) {
+        vectores = move(v);
+        n = vectores.size() / DIMENSION;
+        nivel.resize(n);
+        enlacesBase.assign(n * (M0 + 1), 0);
+        enlacesSuperiores.assign(n, vector<int>());
+        for (size_t i = 0; i < n; i++) {
+            nivel[i] = nivelAleatorio(i);
+            if (nivel[i] > 0)
+                enlacesSuperiores[i].assign(nivel[i] * (M + 1), 0);
+        }
+        entrada = n > 0 ? 0 : -1;
+        nivelMaximo = n > 0 ? nivel[0] : -1;
+        if (n < 2)
+            return;
+        candados = make_unique<mutex[]>(n);
+        construyendo = true;
+        paraCadaBloque(n - 1, PoolHilos::global().tamano() * 8, [&](size_t desde, size_t hasta, size_t) {
+            for (size_t i = desde; i < hasta; i++)
+                insertar(i + 1);
+        });
+        construyendo = false;
+        candados.reset();
+    }
+
+    // Los k nodos mas cercanos a la consulta como (1 - coseno, pelicula), de menor a mayor distancia.
+    vector<pair<float, int>> buscar(const float* consulta, size_t k, int ef = EF_BUSQUEDA) const {
+        if (entrada == -1 || k == 0)
+            return {};
+        int actual = entrada;
+        for (int capa = nivelMaximo; capa > 0; capa--)
+            actual = codicioso(consulta, actual, capa);
+        vector<pair<float, int>> salida = buscarEnCapa(consulta, actual, max(ef, (int)k), 0);
+        if (salida.size() > k)
+            salida.resize(k);
+        return salida;
+    }
+
+    // Formato binario: cabecera (magia, n, dimension, M, huella de los vectores, entrada,
+    // nivel maximo), niveles, capa 0 y capas superiores. Los vectores no se guardan: se
+    // recalculan al cargar el catalogo y la huella comprueba que el grafo les corresponde.
+    bool guardar(const string &archivo) const {
+        ofstream salida(archivo, ios::binary);
+        if (!salida)
+            return false;
+        uint64_t cabecera[7] = {MAGIA, n, DIMENSION, M, huellaBytes(vectores.data(), vectores.size() * sizeof(float)),
+                                (uint64_t)(int64_t)entrada, (uint64_t)(int64_t)nivelMaximo};
+        salida.write((const char*)cabecera, sizeof(cabecera));
+        salida.write((const char*)nivel.data(), nivel.size() * sizeof(int));
+        salida.write((const char*)enlacesBase.data(), enlacesBase.size() * sizeof(int));
+        for (const vector<int> &superiores : enlacesSuperiores)
+            salida.write((const char*)superiores.data(), superiores.size() * sizeof(int));
+        return (bool)salida;
+    }
+
+    // Carga el grafo si el archivo corresponde a estos vectores. Si no (o si esta danado)
+    // devuelve false y deja 'v' intacto para construirlo.
+    bool cargar(const string &archivo, vector<float> &v) {
+        ifstream entradaArchivo(archivo, ios::binary);
+        if (!entradaArchivo)
+            return false;
+        size_t total = v.size() / DIMENSION;
+        uint64_t cabecera[7];
+        if (!entradaArchivo.read((char*)cabecera, sizeof(cabecera)) || cabecera[0] != MAGIA ||
+            cabecera[1] != total || cabecera[2] != (uint64_t)DIMENSION || cabecera[3] != (uint64_t)M ||
+            cabecera[4] != huellaBytes(v.data(), v.size() * sizeof(float)))
+            return false;
+        int entradaLeida = (int)(int64_t)cabecera[5], nivelLeido = (int)(int64_t)cabecera[6];
+        vector<int> niveles(total);
+        vector<int> base(total * (M0 + 1));
+        vector<vector<int>> superiores(total);
+        entradaArchivo.read((char*)niveles.data(), niveles.size() * sizeof(int));
+        entradaArchivo.read((char*)base.data(), base.size() * sizeof(int));
+        for (size_t i = 0; i < total && entradaArchivo; i++) {
+            if (niveles[i] < 0 || niveles[i] > 30)
+                return false;
+            superiores[i].resize(niveles[i] * (M + 1));
+            entradaArchivo.read((char*)superiores[i].data(), superiores[i].size() * sizeof(int));
+        }
+        if (!entradaArchivo)
+            return false;
+        // Validar cantidades e ids para no recorrer un grafo corrupto.
+        auto validos = [&](const int* lista, int capacidad) {
+            if (lista[0] < 0 || lista[0] > capacidad)
+                return false;
+            for (int k = 1; k <= lista[0]; k++)
+                if (lista[k] < 0 || lista[k] >= (int)total)
+                    return false;
+            return true;
+        };
+        for (size_t i = 0; i < total; i++) {
+            if (!validos(&base[i * (M0 + 1)], M0))
+                return false;
+            for (int capa = 0; capa < niveles[i]; capa++)
+                if (!validos(&superiores[i][capa * (M + 1)], M))
+                    return false;
+        }
+        if (total > 0 && (entradaLeida < 0 || entradaLeida >= (int)total || niveles[entradaLeida] != nivelLeido))
+            return false;
+        vectores = move(v);
+        n = total;
+        nivel = move(niveles);
+        enlacesBase = move(base);
+        enlacesSuperiores = move(superiores);
+        entrada = total > 0 ? entradaLeida : -1;
+        nivelMaximo = total > 0 ? nivelLeido : -1;
+        return true;
+    }
+};
+
+// Suma a 'v' la proyeccion de un termino o etiqueta: peso con el signo de cada bit del hash.
+void sumarProyeccion(float* v, uint64_t clave, float peso) {
+    for (int bloque = 0; bloque < IndiceHNSW::DIMENSION; bloque += 64) {
+        uint64_t signos = mezclarBits(clave + bloque);
+        for (int d = 0; d < 64 && bloque + d < IndiceHNSW::DIMENSION; d++)
+            v[bloque + d] += ((signos >> d) & 1) ? peso : -peso;
+    }
+}
+
+// Vectores densos de todas las peliculas (ver arriba), normalizados; una pelicula sin terminos
+// ni etiquetas queda en cero. Se calculan en paralelo por bloques.
+vector<float> construirVectoresDensos(const vector<Pelicula>& peliculas, const IndiceSimilitud &similitud) {
+    const uint64_t SEMILLA_ETIQUETAS = 0x65746971ULL;
+    const size_t D = IndiceHNSW::DIMENSION;
+    vector<float> vectores(peliculas.size() * D, 0);
+    paraCadaBloque(peliculas.size(), PoolHilos::global().tamano(), [&](size_t desde, size_t hasta, size_t) {
+        for (size_t i = desde; i < hasta; i++) {
+            float* v = &vectores[i * D];
+            for (uint32_t k = similitud.inicio[i]; k < similitud.inicio[i + 1]; k++)
+                sumarProyeccion(v, similitud.huellaTermino[similitud.terminos[k]], similitud.pesos[k]);
+            const vector<string> &etiquetas = peliculas[i].etiquetas;
+            for (const string &etiqueta : etiquetas) {
+                string clave = aMinusculas(recortar(etiqueta));
+                sumarProyeccion(v, huellaBytes(clave.data(), clave.size()) ^ SEMILLA_ETIQUETAS,
+                                1.0f / sqrt((float)etiquetas.size()));
+            }
+            float norma = sqrt(productoPunto(v, v, D));
+            if (norma > 0)
+                for (size_t d = 0; d < D; d++)
+                    v[d] /= norma;
+        }
+    });
+    return vectores;
+}
+
+// Las k peliculas mas parecidas al conjunto de gustadas (coseno con la suma de sus vectores
+// densos), sin repetir las de 'excluidas'. Se consulta el grafo HNSW pidiendo de mas para
+// compensar las descartadas.
+vector<int> similaresAlConjunto(const IndiceHNSW &hnsw, const vector<int> &gustadas,
+                                const vector<int> &excluidas, size_t k) {
+    vector<int> salida;
+    size_t n = hnsw.tamano();
+    if (gustadas.empty() || k == 0)
+        return salida;
+    vector<float> centro(IndiceHNSW::DIMENSION, 0);
+    for (int pelicula : gustadas)
+        if (pelicula >= 0 && pelicula < (int)n) {
+            const float* v = hnsw.vectorPelicula(pelicula);
+            for (int d = 0; d < IndiceHNSW::DIMENSION; d++)
+                centro[d] += v[d];
+        }
+    vector<int> descartadas(excluidas);
+    descartadas.insert(descartadas.end(), gustadas.begin(), gustadas.end());
+    sort(descartadas.begin(), descartadas.end());
+    for (auto &[distancia, pelicula] : hnsw.buscar(centro.data(), k + descartadas.size())) {
+        if (salida.size() >= k)
+            break;
+        if (distancia < 1.0f && !binary_search(descartadas.begin(), descartadas.end(), pelicula))
+            salida.push_back(pelicula);
+    }
+    return salida;
+}
+
+// Version de referencia por fuerza bruta (recorre todo el catalogo). Los modos interactivo y
+// servidor usan RecomendadorIncremental y recomendarPorEtiquetas, que dan el mismo orden: como
+// el indice de etiquetas, compara las etiquetas en minusculas y cuenta cada una una sola vez.
+// A igual numero de etiquetas en comun, si se pasan contadores, gana la pelicula mas popular.
+vector<Pelicula*> recomendarPeliculas(const vector<Pelicula>& peliculas, const ListaUsuario& gustadas,
+                                      const ContadoresPopularidad* popularidad) {
+    set<string> etiquetasGustadas;
+    for (int pelicula : gustadas.ids())
+        for (auto &etiqueta : peliculas[pelicula].etiquetas)
+            etiquetasGustadas.insert(aMinusculas(etiqueta));
+    vector<pair<Pelicula*, int>> puntajes;
+    for (auto &pelicula : peliculas) {
+        if (gustadas.contiene(&pelicula - peliculas.data()))
+            continue;
+        set<string> etiquetas;
+        for (auto &etiqueta : pelicula.etiquetas)
+            etiquetas.insert(aMinusculas(etiqueta));
+        int puntaje = 0;
+        for (auto &etiqueta : etiquetas)
+            if (etiquetasGustadas.count(etiqueta))
+                puntaje++;
+        if (puntaje > 0)
+            puntajes.push_back(make_pair(const_cast<Pelicula*>(&pelicula), puntaje));
+    }
+    const Pelicula* base = peliculas.data();
+    sort(puntajes.begin(), puntajes.end(), [&](auto &a, auto &b){
+        if (a.second != b.second)
+            return a.second > b.second;
+        if (popularidad) {
+            int64_t pa = popularidad->puntuacion(a.first - base), pb = popularidad->puntuacion(b.first - base);
+            if (pa != pb)
+                return pa > pb;
+        }
+        return a.first < b.first;
+    });
+    vector<Pelicula*> recomendadas;
+    for (size_t i = 0; i < puntajes.size() && i < 5; i++)
+        recomendadas.push_back(puntajes[i].first);
+    return recomendadas;
+}
+
+// -------------------- FILTRADO COLABORATIVO (ALS IMPLICITO) --------------------
+// Trabajo fuera de linea: a partir de un registro de eventos "usuario,imdb_id,like" (like 1 o 0;
+// vale el ultimo evento de cada par usuario-pelicula) se entrena una factorizacion de matrices
+// para feedback implicito (ALS de Hu, Koren y Volinsky): cada like es una preferencia 1 con
+// confianza 1 + ALFA_CF y el resto de los pares, preferencia 0 con confianza 1. Cada medio paso
+// fija un lado y resuelve cada fila del otro con unos pasos de gradiente conjugado (arrancando del
+// valor anterior), repartiendo las filas en el pool. Solo se guardan los factores de las
+// peliculas: el del usuario se obtiene con el mismo sistema a partir de sus gustadas.
+const int DIMENSION_CF = 32;
+const int ITERACIONES_CF = 10;
+const int PASOS_CG = 3;
+const float ALFA_CF = 40.0f;
+const float LAMBDA_CF = 0.1f;
+const uint64_t MAGIA_CF = 0x31534c4146ULL;   // "FALS1"
+string archivoFactoresCF;   // Si no esta vacio, cada instantanea carga de aqui los factores de peliculas
+
+struct ModeloFactores {
+    int dimension = 0;                 // 0 si no hay modelo cargado
+    float alfa = ALFA_CF;
+    float lambda = LAMBDA_CF;
+    vector<float> factores;            // dimension floats por pelicula del catalogo (cero si no tiene)
+    vector<unsigned char> conFactor;
+    vector<float> gramiana;            // Suma de y * y^T de todas las peliculas del modelo
+};
+
+// Suma de y * y^T de n filas de F floats, en paralelo por bloques.
+vector<float> calcularGramiana(const float* filas, size_t n, int F) {
+    size_t numBloques = PoolHilos::global().tamano();
+    vector<vector<double>> parciales(numBloques, vector<double>(F * F, 0));
+    paraCadaBloque(n, numBloques, [&](size_t desde, size_t hasta, size_t bloque) {
+        vector<double> &suma = parciales[bloque];
+        for (size_t i = desde; i < hasta; i++) {
+            const float* y = filas + i * F;
+            for (int a = 0; a < F; a++)
+                if (y[a] != 0)
+                    for (int b = 0; b < F; b++)
+                        suma[a * F + b] += (double)y[a] * y[b];
+        }
+    });
+    vector<float> gramiana(F * F, 0);
+    for (int k = 0; k < F * F; k++) {
+        double total = 0;
+        for (auto &parcial : parciales)
+            total += parcial[k];
+        gramiana[k] = total;
+    }
+    return gramiana;
+}
+
+// Aproxima la solucion de (G + lambda I + alfa * suma y y^T) x = (1 + alfa) * suma y, donde las
+// y son las filas 'indices' de 'otros', con 'pasos' iteraciones de gradiente conjugado desde x.
+// Cada iteracion cuesta F^2 + 2F por fila gustada, en vez de armar y factorizar la matriz.
+void resolverFilaCG(const vector<float> &gramiana, float lambda, float alfa, const float* otros,
+                    const uint32_t* indices, size_t cantidad, int F, float* x, int pasos) {
+    thread_local vector<float> r, p, ap;
+    r.assign(F, 0);
+    p.assign(F, 0);
+    ap.assign(F, 0);
+    auto productoSistema = [&](const float* v, float* salida) {
+        for (int a = 0; a < F; a++)
+            salida[a] = productoPunto(&gramiana[a * F], v, F) + lambda * v[a];
+        for (size_t k = 0; k < cantidad; k++) {
+            const float* y = otros + (size_t)indices[k] * F;
+            float coef = alfa * productoPunto(y, v, F);
+            for (int a = 0; a < F; a++)
+                salida[a] += coef * y[a];
+        }
+    };
+    productoSistema(x, ap.data());
+    for (int a = 0; a < F; a++)
+        r[a] = -ap[a];
+    for (size_t k = 0; k < cantidad; k++) {
+        const float* y = otros + (size_t)indices[k] * F;
+        for (int a = 0; a < F; a++)
+            r[a] += (1 + alfa) * y[a];
+    }
+    p = r;
+    float residuo = productoPunto(r.data(), r.data(), F);
+    for (int paso = 0; paso < pasos && residuo > 1e-10f; paso++) {
+        productoSistema(p.data(), ap.data());
+        float denominador = productoPunto(p.data(), ap.data(), F);
+        if (denominador <= 0)
+            break;
+        float a = residuo / denominador;
+        for (int d = 0; d < F; d++) {
+            x[d] += a * p[d];
+            r[d] -= a * ap[d];
+        }
+        float nuevo = productoPunto(r.data(), r.data(), F);
+        for (int d = 0; d < F; d++)
+            p[d] = r[d] + (nuevo / residuo) * p[d];
+        residuo = nuevo;
+    }
+}
+
+// Evento leido del registro; los ids se guardan como hash de su texto hasta asignarles ids densos.
+struct EventoCF {
+    uint64_t usuario;
+    uint64_t pelicula;   // Hash del imdb_id con el bit 0 reemplazado por el like
+};
+
+// Parsea las lineas completas de [desde, hasta). Devuelve cuantas lineas no eran eventos validos.
+size_t parsearEventosCF(const char* desde, const char* hasta, vector<EventoCF> &eventos,
+                        unordered_map<uint64_t, string> &nombres) {
+    size_t invalidas = 0;
+    auto recortarCampo = [](const char* &a, const char* &b) {
+        while (a < b && isspace((unsigned char)*a))
+            a++;
+        while (b > a && isspace((unsigned char)b[-1]))
+            b--;
+    };
+    while (desde < hasta) {
+        const char* finLinea = (const char*)memchr(desde, '\n', hasta - desde);
+        if (!finLinea)
+            finLinea = hasta;
+        const char* coma1 = (const char*)memchr(desde, ',', finLinea - desde);
+        const char* coma2 = coma1 ? (const char*)memchr(coma1 + 1, ',', finLinea - coma1 - 1) : nullptr;
+        if (coma2) {
+            const char *u0 = desde, *u1 = coma1, *p0 = coma1 + 1, *p1 = coma2, *l0 = coma2 + 1, *l1 = finLinea;
+            recortarCampo(u0, u1);
+            recortarCampo(p0, p1);
+            recortarCampo(l0, l1);
+            if (u0 < u1 && p0 < p1 && l1 - l0 == 1 && (*l0 == '0' || *l0 == '1')) {
+                uint64_t hashPelicula = mezclarBits(huellaBytes(p0, p1 - p0)) & ~1ULL;
+                eventos.push_back({mezclarBits(huellaBytes(u0, u1 - u0)), hashPelicula | (uint64_t)(*l0 == '1')});
+                if (!nombres.count(hashPelicula))
+                    nombres.emplace(hashPelicula, string(p0, p1));
+            } else
+                invalidas++;
+        } else if (finLinea > desde)
+            invalidas++;
+        desde = finLinea + 1;
+    }
+    return invalidas;
+}
+
+// Trabajo de entrenamiento: lee el registro por trozos (parseados en paralelo), arma la matriz
+// usuario-pelicula de likes vigentes en formato CSR (y su transpuesta), corre ALS y escribe el
+// modelo: cabecera (magia, peliculas, dimension, alfa, lambda), los imdb_id (largo de 16 bits +
+// texto) y los factores en float.
+int ejecutarEntrenamientoCF(const string &archivoEventos, const string &archivoSalida, int F, int iteraciones) {
+    const size_t TAM_LECTURA = 64u << 20;
+    auto inicio = chrono::steady_clock::now();
+    ifstream entrada(archivoEventos, ios::binary);
+    if (!entrada) {
+        cerr << "No se pudo abrir el registro de eventos " << archivoEventos << "." << endl;
+        return 1;
+    }
+    PoolHilos &pool = PoolHilos::global();
+    size_t numBloques = pool.tamano() * 4;
+    vector<EventoCF> eventos;
+    unordered_map<uint64_t, string> nombres;
+    size_t invalidas = 0;
+    string buffer, resto;
+    while (true) {
+        buffer.swap(resto);
+        size_t previo = buffer.size();
+        buffer.resize(previo + TAM_LECTURA);
+        entrada.read(&buffer[previo], TAM_LECTURA);
+        buffer.resize(previo + entrada.gcount());
+        bool fin = !entrada;
+        size_t corte = buffer.size();
+        if (!fin) {
+            size_t ultimo = buffer.rfind('\n');
+            corte = ultimo == string::npos ? 0 : ultimo + 1;
+        }
+        resto.assign(buffer, corte, string::npos);
+        // Cortes de los bloques alineados al comienzo de una linea.
+        vector<size_t> cortes(numBloques + 1, corte);
+        cortes[0] = 0;
+        for (size_t b = 1; b < numBloques; b++) {
+            size_t pos = max(cortes[b - 1], corte * b / numBloques);
+            while (pos < corte && pos > 0 && buffer[pos - 1] != '\n')
+                pos++;
+            cortes[b] = pos;
+        }
+        vector<vector<EventoCF>> parciales(numBloques);
+        vector<unordered_map<uint64_t, string>> nombresParciales(numBloques);
+        vector<size_t> invalidasParciales(numBloques, 0);
+        paraCadaBloque(numBloques, numBloques, [&](size_t desde, size_t hasta, size_t) {
+            for (size_t b = desde; b < hasta; b++)
+                invalidasParciales[b] = parsearEventosCF(buffer.data() + cortes[b], buffer.data() + cortes[b + 1],
+                                                         parciales[b], nombresParciales[b]);
+        });
+        for (size_t b = 0; b < numBloques; b++) {
+            eventos.insert(eventos.end(), parciales[b].begin(), parciales[b].end());
+            nombres.insert(nombresParciales[b].begin(), nombresParciales[b].end());
+            invalidas += invalidasParciales[b];
+        }
+        if (fin)
+            break;
+    }
+    size_t numEventos = eventos.size();
+
+    // Ids densos: hashes ordenados de usuarios y de peliculas.
+    vector<uint64_t> hashUsuarios(numEventos);
+    for (size_t e = 0; e < numEventos; e++)
+        hashUsuarios[e] = eventos[e].usuario;
+    sort(hashUsuarios.begin(), hashUsuarios.end());
+    hashUsuarios.erase(unique(hashUsuarios.begin(), hashUsuarios.end()), hashUsuarios.end());
+    vector<uint64_t> hashPeliculas;
+    for (auto &par : nombres)
+        hashPeliculas.push_back(par.first);
+    sort(hashPeliculas.begin(), hashPeliculas.end());
+    size_t numUsuarios = hashUsuarios.size(), numPeliculas = hashPeliculas.size();
+    vector<uint32_t> usuarioDe(numEventos), valorDe(numEventos);   // valor: pelicula << 1 | like
+    paraCadaBloque(numEventos, numBloques, [&](size_t desde, size_t hasta, size_t) {
+        for (size_t e = desde; e < hasta; e++) {
+            usuarioDe[e] = lower_bound(hashUsuarios.begin(), hashUsuarios.end(), eventos[e].usuario) - hashUsuarios.begin();
+            uint32_t pelicula = lower_bound(hashPeliculas.begin(), hashPeliculas.end(), eventos[e].pelicula & ~1ULL) -
+                                hashPeliculas.begin();
+            valorDe[e] = pelicula << 1 | (uint32_t)(eventos[e].pelicula & 1);
+        }
+    });
+    vector<EventoCF>().swap(eventos);
+
+    // Filas por usuario (ordenamiento por conteo: estable, conserva el orden del registro).
+    vector<uint32_t> inicioUsuario(numUsuarios + 1, 0);
+    for (uint32_t u : usuarioDe)
+        inicioUsuario[u + 1]++;
+    for (size_t u = 0; u < numUsuarios; u++)
+        inicioUsuario[u + 1] += inicioUsuario[u];
+    vector<uint32_t> filas(numEventos);
+    {
+        vector<uint32_t> llenado(inicioUsuario.begin(), inicioUsuario.end() - 1);
+        for (size_t e = 0; e < numEventos; e++)
+            filas[llenado[usuarioDe[e]]++] = valorDe[e];
+    }
+    vector<uint32_t>().swap(usuarioDe);
+    vector<uint32_t>().swap(valorDe);
+    // En cada fila queda el ultimo evento de cada pelicula, y solo si es un like.
+    vector<uint32_t> vigentes(numUsuarios, 0);
+    paraCadaBloque(numUsuarios, numBloques, [&](size_t desde, size_t hasta, size_t) {
+        for (size_t u = desde; u < hasta; u++) {
+            uint32_t* fila = &filas[inicioUsuario[u]];
+            size_t largo = inicioUsuario[u + 1] - inicioUsuario[u];
+            stable_sort(fila, fila + largo, [](uint32_t a, uint32_t b){ return (a >> 1) < (b >> 1); });
+            size_t escritos = 0;
+            for (size_t k = 0; k < largo; k++)
+                if ((k + 1 == largo || (fila[k + 1] >> 1) != (fila[k] >> 1)) && (fila[k] & 1))
+                    fila[escritos++] = fila[k] >> 1;
+            vigentes[u] = escritos;
+        }
+    });
+    vector<uint32_t> inicioLikes(numUsuarios + 1, 0);
+    for (size_t u = 0; u < numUsuarios; u++)
+        inicioLikes[u + 1] = inicioLikes[u] + vigentes[u];
+    vector<uint32_t> likesUsuario(inicioLikes[numUsuarios]);
+    for (size_t u = 0; u < numUsuarios; u++)
+        copy(&filas[inicioUsuario[u]], &filas[inicioUsuario[u]] + vigentes[u], &likesUsuario[inicioLikes[u]]);
+    vector<uint32_t>().swap(filas);
+    // Transpuesta: usuarios de cada pelicula.
+    vector<uint32_t> inicioPelicula(numPeliculas + 1, 0);
+    for (uint32_t pelicula : likesUsuario)
+        inicioPelicula[pelicula + 1]++;
+    for (size_t i = 0; i < numPeliculas; i++)
+        inicioPelicula[i + 1] += inicioPelicula[i];
+    vector<uint32_t> likesPelicula(likesUsuario.size());
+    {
+        vector<uint32_t> llenado(inicioPelicula.begin(), inicioPelicula.end() - 1);
+        for (size_t u = 0; u < numUsuarios; u++)
+            for (uint32_t k = inicioLikes[u]; k < inicioLikes[u + 1]; k++)
+                likesPelicula[llenado[likesUsuario[k]]++] = u;
+    }
+    chrono::duration<double> tiempoLectura = chrono::steady_clock::now() - inicio;
+    cerr << "Eventos: " << numEventos << " (" << invalidas << " lineas invalidas), likes vigentes: "
+         << likesUsuario.size() << ", usuarios: " << numUsuarios << ", peliculas: " << numPeliculas
+         << " (" << tiempoLectura.count() << " s)." << endl;
+
+    // ALS: valores iniciales pequenos y deterministas.
+    vector<float> factoresUsuario(numUsuarios * F), factoresPelicula(numPeliculas * F);
+    for (size_t k = 0; k < factoresUsuario.size(); k++)
+        factoresUsuario[k] = (mezclarBits(k) >> 40) * 0x1.0p-24f * 0.01f;
+    for (size_t k = 0; k < factoresPelicula.size(); k++)
+        factoresPelicula[k] = (mezclarBits(k ^ MAGIA_CF) >> 40) * 0x1.0p-24f * 0.01f;
+    for (int it = 0; it < iteraciones; it++) {
+        auto inicioIteracion = chrono::steady_clock::now();
+        vector<float> gramiana = calcularGramiana(factoresPelicula.data(), numPeliculas, F);
+        paraCadaBloque(numUsuarios, numBloques * 4, [&](size_t desde, size_t hasta, size_t) {
+            for (size_t u = desde; u < hasta; u++)
+                resolverFilaCG(gramiana, LAMBDA_CF, ALFA_CF, factoresPelicula.data(), &likesUsuario[inicioLikes[u]],
+                               inicioLikes[u + 1] - inicioLikes[u], F, &factoresUsuario[u * F], PASOS_CG);
+        });
+        gramiana = calcularGramiana(factoresUsuario.data(), numUsuarios, F);
+        paraCadaBloque(numPeliculas, numBloques * 4, [&](size_t desde, size_t hasta, size_t) {
+            for (size_t i = desde; i < hasta; i++)
+                resolverFilaCG(gramiana, LAMBDA_CF, ALFA_CF, factoresUsuario.data(), &likesPelicula[inicioPelicula[i]],
+                               inicioPelicula[i + 1] - inicioPelicula[i], F, &factoresPelicula[i * F], PASOS_CG);
+        });
+        chrono::duration<double> tiempo = chrono::steady_clock::now() - inicioIteracion;
+        cerr << "Iteracion " << it + 1 << "/" << iteraciones << ": " << tiempo.count() << " s." << endl;
+    }
+
+    ofstream salida(archivoSalida, ios::binary);
+    uint64_t cabecera[3] = {MAGIA_CF, numPeliculas, (uint64_t)F};
+    float parametros[2] = {ALFA_CF, LAMBDA_CF};
+    salida.write((const char*)cabecera, sizeof(cabecera));
+    salida.write((const char*)parametros, sizeof(parametros));
+    for (uint64_t hash : hashPeliculas) {
+        const string &nombre = nombres[hash];
+        uint16_t largo = min(nombre.size(), (size_t)UINT16_MAX);
+        salida.write((const char*)&largo, sizeof(largo));
+        salida.write(nombre.data(), largo);
+    }
+    salida.write((const char*)factoresPelicula.data(), factoresPelicula.size() * sizeof(float));
+    if (!salida) {
+        cerr << "No se pudo escribir el modelo en " << archivoSalida << "." << endl;
+        return 1;
+    }
+    chrono::duration<double> total = chrono::steady_clock::now() - inicio;
+    cerr << "Modelo guardado en " << archivoSalida << " (" << numPeliculas << " x " << F << ") en "
+         << total.count() << " s." << endl;
+    return 0;
+}
+
+// Carga los factores de un modelo y los ubica por imdb_id en el catalogo (las peliculas del
+// modelo que ya no estan se usan igual para la gramiana, que describe al modelo completo).
+bool cargarModeloFactores(const string &archivo, const unordered_map<string, int> &indicePorId,
+                          size_t numPeliculas, ModeloFactores &modelo) {
+    ifstream entrada(archivo, ios::binary);
+    uint64_t cabecera[3];
+    float parametros[2];
+    if (!entrada || !entrada.read((char*)cabecera, sizeof(cabecera)) || !entrada.read((char*)parametros, sizeof(parametros)) ||
+        cabecera[0] != MAGIA_CF || cabecera[2] == 0 || cabecera[2] > 1024)
+        return false;
+    size_t total = cabecera[1];
+    int F = cabecera[2];
+    vector<int> posicion;
+    string nombre;
+    for (size_t i = 0; i < total; i++) {
+        uint16_t largo;
+        if (!entrada.read((char*)&largo, sizeof(largo)))
+            return false;
+        nombre.resize(largo);
+        if (!entrada.read(&nombre[0], largo))
+            return false;
+        auto it = indicePorId.find(nombre);
+        posicion.push_back(it == indicePorId.end() ? -1 : it->second);
+    }
+    vector<float> factores(total * F);
+    if (!entrada.read((char*)factores.data(), factores.size() * sizeof(float)))
+        return false;
+    modelo.dimension = F;
+    modelo.alfa = parametros[0];
+    modelo.lambda = parametros[1];
+    modelo.gramiana = calcularGramiana(factores.data(), total, F);
+    modelo.factores.assign(numPeliculas * F, 0);
+    modelo.conFactor.assign(numPeliculas, 0);
+    for (size_t i = 0; i < total; i++)
+        if (posicion[i] >= 0) {
+            copy(&factores[i * F], &factores[i * F] + F, &modelo.factores[(size_t)posicion[i] * F]);
+            modelo.conFactor[posicion[i]] = 1;
+        }
+    return true;
+}
+
+// Factor del usuario a partir de sus gustadas (el sistema del entrenamiento, con tantos pasos de
+// gradiente conjugado como dimensiones) y las k peliculas de mayor puntaje x . y, sin repetir
+// gustadas ni excluidas. El puntaje de cada pelicula es un producto punto con AVX2.
+vector<int> recomendarPorFactores(const ModeloFactores &modelo, const vector<int> &gustadas,
+                                  const vector<int> &excluidas, size_t k) {
+    vector<int> salida;
+    int F = modelo.dimension;
+    vector<uint32_t> conocidas;
+    for (int pelicula : gustadas)
+        if (pelicula >= 0 && pelicula < (int)modelo.conFactor.size() && modelo.conFactor[pelicula])
+            conocidas.push_back(pelicula);
+    if (F == 0 || conocidas.empty() || k == 0)
+        return salida;
+    vector<float> usuario(F, 0);
+    resolverFilaCG(modelo.gramiana, modelo.lambda, modelo.alfa, modelo.factores.data(), conocidas.data(),
+                   conocidas.size(), F, usuario.data(), F);
+    vector<int> descartadas(excluidas);
+    descartadas.insert(descartadas.end(), gustadas.begin(), gustadas.end());
+    sort(descartadas.begin(), descartadas.end());
+    priority_queue<pair<float, int>, vector<pair<float, int>>, greater<pair<float, int>>> mejores;
+    for (size_t i = 0; i < modelo.conFactor.size(); i++) {
+        if (!modelo.conFactor[i] || binary_search(descartadas.begin(), descartadas.end(), (int)i))
+            continue;
+        float puntaje = productoPunto(usuario.data(), &modelo.factores[i * F], F);
+        if (mejores.size() < k)
+            mejores.push(make_pair(puntaje, -(int)i));
+        else if (make_pair(puntaje, -(int)i) > mejores.top()) {
+            mejores.pop();
+            mejores.push(make_pair(puntaje, -(int)i));
+        }
+    }
+    salida.resize(mejores.size());
+    for (size_t i = salida.size(); i-- > 0; mejores.pop())
+        salida[i] = -mejores.top().second;
+    return salida;
+}
+
+// -------------------- ARBOL DE SUFIJOS CON ALGORITMO DE UKKONEN --------------------
+// Nota: Esta implementacion es una version simplificada.
+class ArbolSufijosUkkonen {
+public:
+    // Los hijos y los conjuntos de peliculas de cada nodo reservan con AsignadorContador, de modo
+    // que el arbol sabe exactamente cuanta memoria ocupan (ver reportarMemoria).
+    struct Nodo;
+    using MapaHijos = unordered_map<char, Nodo*, hash<char>, equal_to<char>, AsignadorContador<pair<const char, Nodo*>>>;
+    using ConjuntoPeliculas = set<int, less<int>, AsignadorContador<int>>;
+    struct Nodo {
+        MapaHijos hijos;
+        int inicio;
+        int* fin;
+        Nodo* enlaceSufijo;
+        ConjuntoPeliculas indicesPeliculas;
+        int indiceSufijo;
+        Nodo(int inicio, int* fin, size_t* bytesHijos, size_t* bytesConjuntos)
+          : hijos(0, hash<char>(), equal_to<char>(), AsignadorContador<pair<const char, Nodo*>>(bytesHijos)),
+            inicio(inicio), fin(fin), enlaceSufijo(nullptr),
+            indicesPeliculas(less<int>(), AsignadorContador<int>(bytesConjuntos)), indiceSufijo(-1) {}
+    };
+
+    static const char TERMINAL = '\x01';   // Fin del texto: ningun sufijo queda implicito
+
+    size_t numNodos = 0;
+    size_t numInternos = 0;   // Nodos con fin propio; las hojas comparten finHoja
+    size_t bytesHijos = 0;
+    size_t bytesConjuntos = 0;
+
+    string texto;
+    Nodo* raiz;
     Nodo* ultimoNodoNuevo;
     Nodo* nodoActivo;
     int aristaActiva;
     int longitudActiva;
     int sufijosPendientes;
-    int finHoja;
-    int tamano; // Longitud de texto
-    vector<int> mapeoPosPeliculas;
+    int finHoja;   // Fin de todas las hojas: crece con cada caracter (regla "una vez hoja, siempre hoja")
+    int tamano; // Longitud de texto (con TERMINAL)
+    // Posicion del texto donde empieza cada pelicula, mas el largo total al final. La pelicula de
+    // una posicion se obtiene con busqueda binaria: 4 bytes por pelicula en vez de por caracter.
+    vector<uint32_t> inicioPeliculas;
 
-    ArbolSufijosUkkonen(const string& txt, const vector<int>& mapeo) : texto(txt), mapeoPosPeliculas(mapeo) {
+    ArbolSufijosUkkonen(string txt, vector<uint32_t> inicios) : texto(move(txt)), inicioPeliculas(move(inicios)) {
+        texto.push_back(TERMINAL);
         tamano = texto.size();
-        raiz = new Nodo(-1, new int(-1));
+        raiz = nuevoNodo(-1, -1);
         nodoActivo = raiz;
         aristaActiva = -1;
         longitudActiva = 0;
@@ -405,6 +2558,33 @@ public:
         propagarIndices(raiz);
     }
 
+    ~ArbolSufijosUkkonen() {
+        vector<Nodo*> pendientes(1, raiz);
+        while (!pendientes.empty()) {
+            Nodo* n = pendientes.back();
+            pendientes.pop_back();
+            for (auto &par : n->hijos)
+                pendientes.push_back(par.second);
+            if (n->fin != &finHoja)
+                delete n->fin;
+            delete n;
+        }
+    }
+
+    Nodo* nuevoNodo(int inicio, int fin) {
+        numNodos++;
+        numInternos++;
+        return new Nodo(inicio, new int(fin), &bytesHijos, &bytesConjuntos);
+    }
+    Nodo* nuevaHoja(int inicio) {
+        numNodos++;
+        return new Nodo(inicio, &finHoja, &bytesHijos, &bytesConjuntos);
+    }
+
+    int peliculaEnPosicion(int pos) const {
+        return upper_bound(inicioPeliculas.begin(), inicioPeliculas.end(), (uint32_t)pos) - inicioPeliculas.begin() - 1;
+    }
+
     void construirArbol() {
         for (int i = 0; i < tamano; i++) {
             extenderArbol(i);
@@ -420,8 +2600,7 @@ public:
                 aristaActiva = pos;
             char cAct = texto[aristaActiva];
             if (nodoActivo->hijos.find(cAct) == nodoActivo->hijos.end()) {
-                nodoActivo->hijos[cAct] = new Nodo(pos, new int(finHoja));
-                nodoActivo->hijos[cAct]->indicesPeliculas.insert(mapeoPosPeliculas[pos]);
+                nodoActivo->hijos[cAct] = nuevaHoja(pos);
                 if (ultimoNodoNuevo != nullptr) {
                     ultimoNodoNuevo->enlaceSufijo = nodoActivo;
                     ultimoNodoNuevo = nullptr;
@@ -443,11 +2622,9 @@ public:
                     longitudActiva++;
                     break;
                 }
-                int* finDividir = new int(siguiente->inicio + longitudActiva - 1);
-                Nodo* nodoDividir = new Nodo(siguiente->inicio, finDividir);
+                Nodo* nodoDividir = nuevoNodo(siguiente->inicio, siguiente->inicio + longitudActiva - 1);
                 nodoActivo->hijos[cAct] = nodoDividir;
-                nodoDividir->hijos[texto[pos]] = new Nodo(pos, new int(finHoja));
-                nodoDividir->hijos[texto[pos]]->indicesPeliculas.insert(mapeoPosPeliculas[pos]);
+                nodoDividir->hijos[texto[pos]] = nuevaHoja(pos);
                 siguiente->inicio += longitudActiva;
                 nodoDividir->hijos[texto[siguiente->inicio]] = siguiente;
                 if (ultimoNodoNuevo != nullptr) {
@@ -474,8 +2651,8 @@ public:
         }
         if (esHoja) {
             n->indiceSufijo = tamano - alturaEtiqueta;
-            if(n->indiceSufijo >= 0 && n->indiceSufijo < mapeoPosPeliculas.size())
-                n->indicesPeliculas.insert(mapeoPosPeliculas[n->indiceSufijo]);
+            if (n->indiceSufijo >= 0 && n->indiceSufijo < (int)inicioPeliculas.back())
+                n->indicesPeliculas.insert(peliculaEnPosicion(n->indiceSufijo));
         }
     }
 
@@ -487,14 +2664,16 @@ public:
         }
     }
 
-    // Busqueda: recorre el arbol y devuelve el conjunto de indices de peliculas.
-    set<int> buscar(const string& patron) {
+    // Busqueda: recorre el arbol y devuelve los indices de las peliculas que contienen el patron,
+    // en orden creciente.
+    vector<int> buscar(const string& patron) const {
         Nodo* nAct = raiz;
         int i = 0;
         while (i < patron.size()) {
-            if (nAct->hijos.find(patron[i]) == nAct->hijos.end())
+            auto it = nAct->hijos.find(patron[i]);
+            if (it == nAct->hijos.end())
                 return {};
-            Nodo* sig = nAct->hijos[patron[i]];
+            Nodo* sig = it->second;
             int largoArista = *(sig->fin) - sig->inicio + 1;
             int j = 0;
             while (j < largoArista && i < patron.size()) {
@@ -504,57 +2683,409 @@ public:
             }
             nAct = sig;
         }
-        return nAct->indicesPeliculas;
+        return vector<int>(nAct->indicesPeliculas.begin(), nAct->indicesPeliculas.end());
     }
-};
 
-// -------------------- PATRON STRATEGY: ESTRATEGIA DE BUSQUEDA --------------------
-class EstrategiaBusqueda {
-public:
-    virtual vector<pair<Pelicula*, int>> buscar(vector<Pelicula>& peliculas, const string &consulta) = 0;
-    virtual ~EstrategiaBusqueda() {}
+    // Nodos (Nodo + su fin) y las reservas reales de hijos y conjuntos; los elementos se cuentan
+    // recorriendo el arbol.
+    void reportarMemoria(ReporteMemoria &reporte) const {
+        size_t enlaces = 0, indices = 0;
+        vector<const Nodo*> pendientes(1, raiz);
+        while (!pendientes.empty()) {
+            const Nodo* n = pendientes.back();
+            pendientes.pop_back();
+            enlaces += n->hijos.size();
+            indices += n->indicesPeliculas.size();
+            for (auto &par : n->hijos)
+                pendientes.push_back(par.second);
+        }
+        reporte.push_back({"Arbol de sufijos: texto", memoriaCadena(texto), texto.size()});
+        reporte.push_back({"Arbol de sufijos: inicios", memoriaVector(inicioPeliculas), inicioPeliculas.size()});
+        reporte.push_back({"Arbol de sufijos: nodos", numNodos * sizeof(Nodo) + numInternos * sizeof(int), numNodos});
+        reporte.push_back({"Arbol de sufijos: hijos", bytesHijos, enlaces});
+        reporte.push_back({"Arbol de sufijos: conjuntos", bytesConjuntos, indices});
+    }
 };
 
-class EstrategiaTituloSinopsis : public EstrategiaBusqueda {
+// Texto global del arbol ("titulo sinopsis#" por pelicula, en minusculas) con su tamano final
+// reservado de una vez, y el inicio de cada pelicula en el texto (mas el largo total al final).
+string construirTextoGlobal(const vector<Pelicula> &peliculas, vector<uint32_t> &inicioPeliculas) {
+    size_t largoTotal = 0;
+    for (const Pelicula &pelicula : peliculas)
+        largoTotal += pelicula.titulo.size() + pelicula.sinopsis.size() + 2;
+    string textoGlobal;
+    textoGlobal.reserve(largoTotal);
+    inicioPeliculas.clear();
+    inicioPeliculas.reserve(peliculas.size() + 1);
+    for (const Pelicula &pelicula : peliculas) {
+        inicioPeliculas.push_back(textoGlobal.size());
+        for (char c : pelicula.titulo)
+            textoGlobal.push_back(::tolower(c));
+        textoGlobal.push_back(' ');
+        for (char c : pelicula.sinopsis)
+            textoGlobal.push_back(::tolower(c));
+        textoGlobal.push_back('#');
+    }
+    inicioPeliculas.push_back(textoGlobal.size());
+    return textoGlobal;
+}
+
+// -------------------- INDICE DE AUTOCOMPLETADO (TRIE DE TITULOS) --------------------
+// Trie sobre los titulos normalizados (minusculas y espacios simples). Cada nodo guarda de
+// antemano las TOP_K peliculas mas populares de su subarbol, por lo que completar un prefijo
+// solo cuesta recorrer el prefijo. Los nodos viven en arreglos planos (primer hijo / siguiente
+// hermano) para que el trie ocupe poca memoria.
+class IndiceAutocompletado {
 public:
-    vector<pair<Pelicula*, int>> buscar(vector<Pelicula>& peliculas, const string &consulta) override {
-        string consultaLower = aMinusculas(consulta);
-        string consultaNorm = normalizarEspacios(consultaLower);
-        // Uso del arbol de sufijos
-        extern ArbolSufijosUkkonen* arbolSufijosGlobal;
-        set<int> indicesCoincidentes = arbolSufijosGlobal->buscar(consultaLower);
-        // Fallback: union con busqueda lineal
-        for (int i = 0; i < peliculas.size(); i++) {
-            string titLower = aMinusculas(peliculas[i].titulo);
-            string sinopLower = aMinusculas(peliculas[i].sinopsis);
-            if (titLower.find(consultaLower) != string::npos || sinopLower.find(consultaLower) != string::npos)
-                indicesCoincidentes.insert(i);
+    static const int TOP_K = 5;
+private:
+    struct Nodo {
+        int primerHijo = -1;
+        int siguienteHermano = -1;
+        int primerTerminal = -1;   // Primera pelicula cuyo titulo termina en este nodo
+        char caracter = 0;
+    };
+    vector<Nodo> nodos;
+    vector<int> mejores;            // TOP_K indices por nodo (-1 si no hay); protegido por mutexMejores
+    mutable shared_mutex mutexMejores;
+    vector<int> siguienteTerminal;  // Lista enlazada de peliculas con el mismo titulo
+    vector<Pelicula>* peliculas = nullptr;
+    const ContadoresPopularidad* popularidad = nullptr;
+
+    int64_t puntuacion(int pelicula) const {
+        return popularidad ? popularidad->puntuacion(pelicula) : 0;
+    }
+
+    int buscarHijo(int nodo, char c) const {
+        for (int h = nodos[nodo].primerHijo; h != -1; h = nodos[h].siguienteHermano)
+            if (nodos[h].caracter == c)
+                return h;
+        return -1;
+    }
+
+    // Recalcula el top-k de un nodo a partir de sus terminales y del top-k de sus hijos.
+    // Orden de popularidad: mayor puntuacion primero; a igualdad, el indice menor. La puntuacion
+    // se lee una sola vez por candidato porque los contadores pueden cambiar mientras se ordena.
+    void recalcularNodo(int nodo) {
+        vector<pair<int64_t, int>> candidatos;
+        for (int t = nodos[nodo].primerTerminal; t != -1; t = siguienteTerminal[t])
+            candidatos.push_back({-puntuacion(t), t});
+        for (int h = nodos[nodo].primerHijo; h != -1; h = nodos[h].siguienteHermano)
+            for (int k = 0; k < TOP_K && mejores[h * TOP_K + k] != -1; k++) {
+                int c = mejores[h * TOP_K + k];
+                candidatos.push_back({-puntuacion(c), c});
+            }
+        size_t tope = min(candidatos.size(), (size_t)TOP_K);
+        partial_sort(candidatos.begin(), candidatos.begin() + tope, candidatos.end());
+        for (int k = 0; k < TOP_K; k++)
+            mejores[nodo * TOP_K + k] = (k < (int)tope) ? candidatos[k].second : -1;
+    }
+
+public:
+    static string normalizarTitulo(const string &titulo) {
+        return normalizarEspacios(aMinusculas(titulo));
+    }
+
+    void construir(vector<Pelicula>& pels, const ContadoresPopularidad* pop = nullptr) {
+        peliculas = &pels;
+        popularidad = pop;
+        nodos.assign(1, Nodo());
+        siguienteTerminal.assign(pels.size(), -1);
+        for (int i = 0; i < (int)pels.size(); i++) {
+            string titulo = normalizarTitulo(pels[i].titulo);
+            int actual = 0;
+            for (char c : titulo) {
+                int hijo = buscarHijo(actual, c);
+                if (hijo == -1) {
+                    hijo = nodos.size();
+                    Nodo nuevo;
+                    nuevo.caracter = c;
+                    nuevo.siguienteHermano = nodos[actual].primerHijo;
+                    nodos.push_back(nuevo);
+                    nodos[actual].primerHijo = hijo;
+                }
+                actual = hijo;
+            }
+            siguienteTerminal[i] = nodos[actual].primerTerminal;
+            nodos[actual].primerTerminal = i;
+        }
+        mejores.assign(nodos.size() * TOP_K, -1);
+        recalcularTodo();
+    }
+
+    // Rehace el top-k de todos los nodos (por ejemplo, tras copiar contadores de otra instantanea).
+    // Los hijos siempre tienen indice mayor que su padre: recorrer al reves es un post-orden.
+    void recalcularTodo() {
+        unique_lock<shared_mutex> lk(mutexMejores);
+        for (int n = (int)nodos.size() - 1; n >= 0; n--)
+            recalcularNodo(n);
+    }
+
+    // Devuelve hasta TOP_K peliculas cuyo titulo empieza con el prefijo, de mas a menos popular.
+    vector<Pelicula*> completar(const string &prefijo) const {
+        vector<Pelicula*> salida;
+        if (nodos.empty())
+            return salida;
+        shared_lock<shared_mutex> lk(mutexMejores);
+        int actual = 0;
+        for (char c : normalizarTitulo(prefijo)) {
+            actual = buscarHijo(actual, c);
+            if (actual == -1)
+                return salida;
+        }
+        for (int k = 0; k < TOP_K && mejores[actual * TOP_K + k] != -1; k++)
+            salida.push_back(&(*peliculas)[mejores[actual * TOP_K + k]]);
+        return salida;
+    }
+
+    // Se llama cuando cambia la popularidad de algunas peliculas: solo se recalculan sus caminos,
+    // de las hojas a la raiz (los hijos tienen indice mayor que su padre).
+    void actualizarPopularidad(const vector<int> &cambiadas) {
+        if (nodos.empty())
+            return;
+        vector<int> caminos(1, 0);
+        for (int pelicula : cambiadas) {
+            int actual = 0;
+            for (char c : normalizarTitulo((*peliculas)[pelicula].titulo)) {
+                actual = buscarHijo(actual, c);
+                caminos.push_back(actual);
+            }
         }
+        sort(caminos.begin(), caminos.end(), greater<int>());
+        caminos.erase(unique(caminos.begin(), caminos.end()), caminos.end());
+        unique_lock<shared_mutex> lk(mutexMejores);
+        for (int nodo : caminos)
+            recalcularNodo(nodo);
+    }
+
+    void reportarMemoria(ReporteMemoria &reporte) const {
+        reporte.push_back({"Autocompletado: nodos", memoriaVector(nodos), nodos.size()});
+        reporte.push_back({"Autocompletado: top-k", memoriaVector(mejores) + memoriaVector(siguienteTerminal), mejores.size()});
+    }
+};
+
+// -------------------- CURSOR DE RESULTADOS (PAGINACION PEREZOSA) --------------------
+// Guarda todas las coincidencias, pero solo ordena lo que se va mostrando: al pedir una pagina
+// se hace partial_sort del tramo que falta hasta el final de esa pagina. El orden es por puntaje
+// descendente y, a igualdad, por posicion en el catalogo, asi las paginas son deterministas.
+class CursorResultados {
+private:
+    vector<pair<Pelicula*, int>> resultados;
+    size_t ordenados = 0;   // Los primeros 'ordenados' elementos ya estan en su posicion final
+public:
+    explicit CursorResultados(vector<pair<Pelicula*, int>> r) : resultados(move(r)) {}
+
+    static bool antes(const pair<Pelicula*, int> &a, const pair<Pelicula*, int> &b) {
+        if (a.second != b.second)
+            return a.second > b.second;
+        return a.first < b.first;
+    }
+
+    size_t total() const {
+        return resultados.size();
+    }
+
+    int totalPaginas() const {
+        return (resultados.size() + RESULTADOS_POR_PAGINA - 1) / RESULTADOS_POR_PAGINA;
+    }
+
+    // Deja en su orden final los primeros n resultados.
+    void asegurarOrdenados(size_t n) {
+        n = min(n, resultados.size());
+        if (n <= ordenados)
+            return;
+        partial_sort(resultados.begin() + ordenados, resultados.begin() + n, resultados.end(), antes);
+        ordenados = n;
+    }
+
+    const pair<Pelicula*, int>& obtener(size_t i) {
+        asegurarOrdenados(i + 1);
+        return resultados[i];
+    }
+
+    // Resultados de la pagina indicada (empezando en 0).
+    vector<pair<Pelicula*, int>> pagina(int numero) {
+        size_t inicio = (size_t)numero * RESULTADOS_POR_PAGINA;
+        size_t fin = min(resultados.size(), inicio + RESULTADOS_POR_PAGINA);
+        asegurarOrdenados(fin);
+        vector<pair<Pelicula*, int>> salida;
+        for (size_t i = inicio; i < fin; i++)
+            salida.push_back(resultados[i]);
+        return salida;
+    }
+};
+
+// -------------------- MEMORIA COMPARTIDA DEL MODO LOTE --------------------
+// En el modo lote se repiten muchas consultas sobre el mismo catalogo: el texto de las peliculas
+// se pasa a minusculas una sola vez y cada fragmento de etiqueta se resuelve una sola vez.
+// Las estrategias la reciben como puntero opcional; sin ella se comportan como siempre.
+struct MemoriaLote {
+    vector<string> titulos;      // En minusculas
+    vector<string> titulosNorm;  // En minusculas y con espacios simples
+    vector<string> sinopsis;     // En minusculas
+    unordered_map<string, vector<int>> etiquetasPorFragmento;
+};
+
+// -------------------- PATRON STRATEGY: ESTRATEGIA DE BUSQUEDA --------------------
+// buscar() devuelve las coincidencias con su puntaje SIN ordenar; el orden lo da CursorResultados.
+// buscarAsync() es la misma busqueda como corrutina sobre el pool (la usa el modo servidor); la
+// estrategia debe seguir viva hasta que la tarea termine.
+class EstrategiaBusqueda {
+public:
+    virtual vector<pair<Pelicula*, int>> buscar(vector<Pelicula>& peliculas, const string &consulta) = 0;
+    // Por defecto solo pasa la busqueda completa a un hilo del pool.
+    virtual Tarea<vector<pair<Pelicula*, int>>> buscarAsync(vector<Pelicula>& peliculas, string consulta) {
+        co_await cambiarAlPool();
+        co_return buscar(peliculas, consulta);
+    }
+    virtual ~EstrategiaBusqueda() {}
+};
+
+// Las candidatas salen del arbol de sufijos (peliculas cuyo "titulo sinopsis" contiene la
+// consulta) y solo ellas se puntuan. Si son al menos UMBRAL_BUSQUEDA_PARALELA y la estrategia es
+// paralela, se puntuan por bloques en el pool. Los resultados de los bloques se concatenan sin
+// ordenar: el orden lo pone CursorResultados, solo hasta la pagina que se pide.
+class EstrategiaTituloSinopsis : public EstrategiaBusqueda {
+private:
+    const ArbolSufijosUkkonen* arbol;
+    bool paralelo;
+    const MemoriaLote* lote;
+public:
+    EstrategiaTituloSinopsis(const ArbolSufijosUkkonen* arbol, bool paralelo = false, const MemoriaLote* lote = nullptr)
+      : arbol(arbol), paralelo(paralelo), lote(lote) {}
+
+    static int puntuar(const Pelicula &pel, const string &consultaLower, const string &consultaNorm) {
+        string titLower = aMinusculas(pel.titulo);
+        string sinopLower = aMinusculas(pel.sinopsis);
+        int puntaje = 0;
+        if (titLower.find(consultaLower) != string::npos) {
+            puntaje += 3;
+            if (normalizarEspacios(titLower) == consultaNorm)
+                puntaje += 50;
+        }
+        if (sinopLower.find(consultaLower) != string::npos)
+            puntaje += 2;
+        return puntaje;
+    }
+
+    // Peliculas que pueden coincidir, en orden; sin arbol, todas.
+    vector<int> candidatas(const vector<Pelicula>& peliculas, const string &consultaLower) const {
+        if (arbol)
+            return arbol->buscar(consultaLower);
+        vector<int> todas(peliculas.size());
+        iota(todas.begin(), todas.end(), 0);
+        return todas;
+    }
+
+    // Mismo puntaje que puntuar(), pero con el texto de la pelicula ya en minusculas.
+    static int puntuarEnLote(const MemoriaLote &lote, int i, const string &consultaLower, const string &consultaNorm) {
+        int puntaje = 0;
+        if (lote.titulos[i].find(consultaLower) != string::npos) {
+            puntaje += 3;
+            if (lote.titulosNorm[i] == consultaNorm)
+                puntaje += 50;
+        }
+        if (lote.sinopsis[i].find(consultaLower) != string::npos)
+            puntaje += 2;
+        return puntaje;
+    }
+
+    vector<pair<Pelicula*, int>> buscar(vector<Pelicula>& peliculas, const string &consulta) override {
+        string consultaLower = aMinusculas(consulta);
+        string consultaNorm = normalizarEspacios(consultaLower);
+        vector<int> ids = candidatas(peliculas, consultaLower);
+        if (paralelo && ids.size() >= UMBRAL_BUSQUEDA_PARALELA)
+            return buscarParalelo(peliculas, ids, consultaLower, consultaNorm);
         vector<pair<Pelicula*, int>> resultados;
-        for (int idx : indicesCoincidentes) {
-            Pelicula &pel = peliculas[idx];
-            string titLower = aMinusculas(pel.titulo);
-            string titNorm = normalizarEspacios(titLower);
-            string sinopLower = aMinusculas(pel.sinopsis);
-            int puntaje = 0;
-            if (titLower.find(consultaLower) != string::npos) {
-                puntaje += 3;
-                if (titNorm == consultaNorm)
-                    puntaje += 50;
-            }
-            if (sinopLower.find(consultaLower) != string::npos)
-                puntaje += 2;
+        puntuarCandidatas(peliculas, lote, ids, 0, ids.size(), consultaLower, consultaNorm, resultados);
+        return resultados;
+    }
+
+    // Version asincrona en etapas: analisis de la consulta y busqueda en el arbol, puntuacion de
+    // cada bloque de candidatas como subtarea del pool y concatenacion de los buffers.
+    Tarea<vector<pair<Pelicula*, int>>> buscarAsync(vector<Pelicula>& peliculas, string consulta) override {
+        co_await cambiarAlPool();
+        string consultaLower = aMinusculas(consulta);
+        string consultaNorm = normalizarEspacios(consultaLower);
+        vector<int> ids = candidatas(peliculas, consultaLower);
+        size_t numBloques = (paralelo && ids.size() >= UMBRAL_BUSQUEDA_PARALELA) ? PoolHilos::global().tamano() * 4 : 1;
+        size_t tamBloque = ids.size() / numBloques;
+        vector<Tarea<vector<pair<Pelicula*, int>>>> bloques;
+        for (size_t b = 0; b < numBloques; b++) {
+            size_t inicio = b * tamBloque;
+            size_t fin = (b == numBloques - 1) ? ids.size() : (b + 1) * tamBloque;
+            bloques.push_back(puntuarBloqueAsync(peliculas, lote, ids, inicio, fin, consultaLower, consultaNorm));
+        }
+        vector<vector<pair<Pelicula*, int>>> buffers = co_await esperarTodas(move(bloques));
+        co_return concatenarBuffers(buffers);
+    }
+
+    static Tarea<vector<pair<Pelicula*, int>>> puntuarBloqueAsync(vector<Pelicula>& peliculas, const MemoriaLote* lote,
+                                                                  const vector<int> &ids, size_t inicio, size_t fin,
+                                                                  const string &consultaLower, const string &consultaNorm) {
+        co_await cambiarAlPool();
+        vector<pair<Pelicula*, int>> buffer;
+        puntuarCandidatas(peliculas, lote, ids, inicio, fin, consultaLower, consultaNorm, buffer);
+        co_return buffer;
+    }
+
+    // Puntua las candidatas ids[inicio, fin) y agrega a buffer las que tienen puntaje. Con memoria
+    // de lote se usa su texto ya en minusculas.
+    static void puntuarCandidatas(vector<Pelicula>& peliculas, const MemoriaLote* lote, const vector<int> &ids,
+                                  size_t inicio, size_t fin, const string &consultaLower, const string &consultaNorm,
+                                  vector<pair<Pelicula*, int>> &buffer) {
+        for (size_t k = inicio; k < fin; k++) {
+            Pelicula &pel = peliculas[ids[k]];
+            int puntaje = lote ? puntuarEnLote(*lote, ids[k], consultaLower, consultaNorm)
+                               : puntuar(pel, consultaLower, consultaNorm);
             if (puntaje > 0)
-                resultados.push_back(make_pair(&pel, puntaje));
+                buffer.push_back(make_pair(&pel, puntaje));
         }
-        sort(resultados.begin(), resultados.end(), [](auto &a, auto &b){ return a.second > b.second; });
+    }
+
+    vector<pair<Pelicula*, int>> buscarParalelo(vector<Pelicula>& peliculas, const vector<int> &ids,
+                                                const string &consultaLower, const string &consultaNorm) {
+        PoolHilos &pool = PoolHilos::global();
+        size_t numBloques = pool.tamano() * 4;   // Bloques pequenos para repartir mejor la carga
+        vector<vector<pair<Pelicula*, int>>> buffers(numBloques);
+        pool.paraCadaBloque(ids.size(), numBloques, [&](size_t inicio, size_t fin, size_t bloque) {
+            puntuarCandidatas(peliculas, lote, ids, inicio, fin, consultaLower, consultaNorm, buffers[bloque]);
+        });
+        return concatenarBuffers(buffers);
+    }
+
+    static vector<pair<Pelicula*, int>> concatenarBuffers(vector<vector<pair<Pelicula*, int>>> &buffers) {
+        size_t total = 0;
+        for (auto &buffer : buffers)
+            total += buffer.size();
+        vector<pair<Pelicula*, int>> resultados;
+        resultados.reserve(total);
+        for (auto &buffer : buffers)
+            resultados.insert(resultados.end(), buffer.begin(), buffer.end());
         return resultados;
     }
 };
 
+// Cada etiqueta de la consulta debe aparecer (como subcadena) en alguna etiqueta de la pelicula.
+// El indice de trigramas resuelve cada fragmento a las etiquetas que lo contienen; luego se hace
+// OR de sus bitmaps y AND entre fragmentos. No se recorre el catalogo en cada consulta.
 class EstrategiaEtiqueta : public EstrategiaBusqueda {
+private:
+    const IndiceEtiquetas &indice;
+    const MemoriaLote* lote;
+
+    vector<int> resolverFragmento(const string &fragmento) const {
+        if (lote) {
+            auto it = lote->etiquetasPorFragmento.find(fragmento);
+            if (it != lote->etiquetasPorFragmento.end())
+                return it->second;
+        }
+        return indice.etiquetasQueContienen(fragmento);
+    }
 public:
-    vector<pair<Pelicula*, int>> buscar(vector<Pelicula>& peliculas, const string &consulta) override {
+    EstrategiaEtiqueta(const IndiceEtiquetas &ind, const MemoriaLote* lote = nullptr) : indice(ind), lote(lote) {}
+
+    static vector<string> separarEtiquetasConsulta(const string &consulta) {
         vector<string> etiquetasConsulta;
         if (consulta.find(',') != string::npos) {
             istringstream iss(consulta);
@@ -567,68 +3098,1056 @@ public:
         } else {
             etiquetasConsulta = tokenizar(consulta);
         }
-        vector<future<vector<pair<Pelicula*, int>>>> futuros;
-        size_t total = peliculas.size();
-        size_t numHilos = NUM_HILOS;
-        size_t tamBloque = total / numHilos;
-        for (size_t i = 0; i < numHilos; i++) {
-            size_t inicio = i * tamBloque;
-            size_t fin = (i == numHilos - 1) ? total : (i + 1) * tamBloque;
-            futuros.push_back(async(launch::async, [&, inicio, fin, etiquetasConsulta]() {
-                vector<pair<Pelicula*, int>> parcial;
-                for (size_t j = inicio; j < fin; j++) {
-                    Pelicula& pel = peliculas[j];
-                    bool valido = true;
-                    for (auto &qt : etiquetasConsulta) {
-                        bool encontrado = false;
-                        for (auto &etiqueta : pel.etiquetas) {
-                            if (aMinusculas(etiqueta).find(qt) != string::npos) {
-                                encontrado = true;
-                                break;
-                            }
-                        }
-                        if (!encontrado) {
-                            valido = false;
-                            break;
-                        }
-                    }
-                    if (valido)
-                        parcial.push_back(make_pair(&pel, 5));
-                }
-                return parcial;
-            }));
+        return etiquetasConsulta;
+    }
+
+    vector<pair<Pelicula*, int>> buscar(vector<Pelicula>& peliculas, const string &consulta) override {
+        vector<vector<int>> fragmentos;
+        for (auto &qt : separarEtiquetasConsulta(consulta))
+            fragmentos.push_back(resolverFragmento(qt));
+        return recolectar(peliculas, combinar(fragmentos));
+    }
+
+    // Version asincrona en etapas: cada fragmento se resuelve en el indice como subtarea del pool,
+    // luego se combinan los bitmaps y se recolectan las peliculas.
+    Tarea<vector<pair<Pelicula*, int>>> buscarAsync(vector<Pelicula>& peliculas, string consulta) override {
+        co_await cambiarAlPool();
+        vector<Tarea<vector<int>>> busquedas;
+        for (auto &qt : separarEtiquetasConsulta(consulta))
+            busquedas.push_back(resolverFragmentoAsync(qt));
+        vector<vector<int>> fragmentos = co_await esperarTodas(move(busquedas));
+        co_return recolectar(peliculas, combinar(fragmentos));
+    }
+
+    Tarea<vector<int>> resolverFragmentoAsync(string fragmento) const {
+        co_await cambiarAlPool();
+        co_return resolverFragmento(fragmento);
+    }
+
+    // AND entre fragmentos del OR de las etiquetas de cada uno.
+    vector<uint64_t> combinar(const vector<vector<int>> &fragmentos) const {
+        size_t palabras = indice.palabrasPorBitmap;
+        // Sin etiquetas en la consulta todas las peliculas son validas.
+        vector<uint64_t> acumulado(palabras, ~(uint64_t)0);
+        if (indice.numPeliculas % 64 != 0 && palabras > 0)
+            acumulado[palabras - 1] = ((uint64_t)1 << (indice.numPeliculas % 64)) - 1;
+        vector<uint64_t> coincidencias(palabras);
+        for (auto &etiquetas : fragmentos) {
+            fill(coincidencias.begin(), coincidencias.end(), 0);
+            for (int id : etiquetas)
+                orBitmap(coincidencias.data(), indice.bitmap(id), palabras);
+            andBitmap(acumulado.data(), coincidencias.data(), palabras);
         }
+        return acumulado;
+    }
+
+    static vector<pair<Pelicula*, int>> recolectar(vector<Pelicula>& peliculas, const vector<uint64_t> &acumulado) {
         vector<pair<Pelicula*, int>> resultados;
-        for (auto &fut : futuros) {
-            vector<pair<Pelicula*, int>> parcial = fut.get();
-            resultados.insert(resultados.end(), parcial.begin(), parcial.end());
+        for (size_t w = 0; w < acumulado.size(); w++) {
+            uint64_t bits = acumulado[w];
+            while (bits) {
+                int bit = countr_zero(bits);
+                resultados.push_back(make_pair(&peliculas[w * 64 + bit], 5));
+                bits &= bits - 1;
+            }
         }
-        sort(resultados.begin(), resultados.end(), [](auto &a, auto &b){ return a.second > b.second; });
         return resultados;
     }
 };
 
+// Busqueda de frases exactas (consulta entre comillas) sobre el indice posicional.
+// Intersecta las listas de peliculas de cada palabra y luego las listas de posiciones,
+// asi "star war" no coincide con "star wars" y la puntuacion no rompe la frase.
+class EstrategiaFrase : public EstrategiaBusqueda {
+private:
+    const IndicePalabras &indice;
+public:
+    EstrategiaFrase(const IndicePalabras &ind) : indice(ind) {}
+
+    // Devuelve las posiciones iniciales de la frase dentro de la pelicula.
+    static vector<int> inicioFrases(const vector<vector<int>> &posicionesPorPalabra) {
+        vector<int> inicios = posicionesPorPalabra[0];
+        for (size_t k = 1; k < posicionesPorPalabra.size() && !inicios.empty(); k++) {
+            const vector<int> &siguiente = posicionesPorPalabra[k];
+            vector<int> validos;
+            size_t a = 0, b = 0;
+            while (a < inicios.size() && b < siguiente.size()) {
+                int esperado = inicios[a] + (int)k;
+                if (siguiente[b] < esperado)
+                    b++;
+                else if (siguiente[b] > esperado)
+                    a++;
+                else {
+                    validos.push_back(inicios[a]);
+                    a++; b++;
+                }
+            }
+            inicios.swap(validos);
+        }
+        return inicios;
+    }
+
+    // Listas de cada palabra de la frase; false si alguna no esta en el indice.
+    bool buscarListas(const vector<string> &palabras, vector<const ListaPosicional*> &listas) const {
+        for (auto &palabra : palabras) {
+            auto it = indice.postings.find(palabra);
+            if (it == indice.postings.end())
+                return false;
+            listas.push_back(&it->second);
+        }
+        return !listas.empty();
+    }
+
+    vector<pair<Pelicula*, int>> buscar(vector<Pelicula>& peliculas, const string &consulta) override {
+        vector<pair<Pelicula*, int>> resultados;
+        vector<string> palabras = tokenizar(consulta);
+        vector<const ListaPosicional*> listas;
+        if (buscarListas(palabras, listas))
+            intersectarRango(peliculas, listas, 0, peliculas.size(), resultados);
+        return resultados;
+    }
+
+    // Version asincrona en etapas: busqueda de las listas en el indice y luego la interseccion y
+    // verificacion de posiciones por rangos de peliculas, cada rango como subtarea del pool.
+    Tarea<vector<pair<Pelicula*, int>>> buscarAsync(vector<Pelicula>& peliculas, string consulta) override {
+        co_await cambiarAlPool();
+        vector<string> palabras = tokenizar(consulta);
+        vector<const ListaPosicional*> listas;
+        if (!buscarListas(palabras, listas))
+            co_return vector<pair<Pelicula*, int>>();
+        size_t menor = listas[0]->postings.size();
+        for (auto lista : listas)
+            menor = min(menor, lista->postings.size());
+        size_t numBloques = menor >= UMBRAL_BUSQUEDA_PARALELA ? PoolHilos::global().tamano() * 4 : 1;
+        size_t tamBloque = peliculas.size() / numBloques;
+        vector<Tarea<vector<pair<Pelicula*, int>>>> bloques;
+        for (size_t b = 0; b < numBloques; b++) {
+            size_t desde = b * tamBloque;
+            size_t hasta = (b == numBloques - 1) ? peliculas.size() : (b + 1) * tamBloque;
+            bloques.push_back(intersectarRangoAsync(peliculas, listas, desde, hasta));
+        }
+        vector<vector<pair<Pelicula*, int>>> buffers = co_await esperarTodas(move(bloques));
+        co_return EstrategiaTituloSinopsis::concatenarBuffers(buffers);
+    }
+
+    Tarea<vector<pair<Pelicula*, int>>> intersectarRangoAsync(vector<Pelicula>& peliculas,
+                                                              const vector<const ListaPosicional*> &listas,
+                                                              size_t desde, size_t hasta) const {
+        co_await cambiarAlPool();
+        vector<pair<Pelicula*, int>> buffer;
+        intersectarRango(peliculas, listas, desde, hasta, buffer);
+        co_return buffer;
+    }
+
+    // Intersecta las listas (una por palabra, en orden de la frase) restringidas a las peliculas
+    // [desde, hasta) y agrega a resultados las que contienen la frase, con su puntaje.
+    void intersectarRango(vector<Pelicula>& peliculas, const vector<const ListaPosicional*> &listas,
+                          size_t desde, size_t hasta, vector<pair<Pelicula*, int>> &resultados) const {
+        // Se avanza un cursor por lista, todas ordenadas por pelicula.
+        vector<size_t> cursores(listas.size()), finales(listas.size());
+        auto porPelicula = [](const PostingPosicional &p, int pelicula) { return p.pelicula < pelicula; };
+        for (size_t k = 0; k < listas.size(); k++) {
+            const vector<PostingPosicional> &postings = listas[k]->postings;
+            cursores[k] = lower_bound(postings.begin(), postings.end(), (int)desde, porPelicula) - postings.begin();
+            finales[k] = lower_bound(postings.begin(), postings.end(), (int)hasta, porPelicula) - postings.begin();
+        }
+        while (true) {
+            int maxPelicula = -1;
+            bool fin = false;
+            for (size_t k = 0; k < listas.size(); k++) {
+                if (cursores[k] >= finales[k]) {
+                    fin = true;
+                    break;
+                }
+                maxPelicula = max(maxPelicula, listas[k]->postings[cursores[k]].pelicula);
+            }
+            if (fin)
+                break;
+            bool alineados = true;
+            for (size_t k = 0; k < listas.size(); k++) {
+                while (cursores[k] < finales[k] && listas[k]->postings[cursores[k]].pelicula < maxPelicula)
+                    cursores[k]++;
+                if (cursores[k] >= finales[k] || listas[k]->postings[cursores[k]].pelicula != maxPelicula)
+                    alineados = false;
+            }
+            if (!alineados)
+                continue;
+            vector<vector<int>> posicionesPorPalabra;
+            for (size_t k = 0; k < listas.size(); k++)
+                posicionesPorPalabra.push_back(listas[k]->posicionesDe(cursores[k]));
+            vector<int> inicios = inicioFrases(posicionesPorPalabra);
+            if (!inicios.empty()) {
+                int largoTitulo = indice.tokensTitulo[maxPelicula];
+                int largoFrase = listas.size();
+                bool enTitulo = false, enSinopsis = false, tituloExacto = false;
+                for (int inicio : inicios) {
+                    if (inicio + largoFrase <= largoTitulo) {
+                        enTitulo = true;
+                        if (inicio == 0 && largoFrase == largoTitulo)
+                            tituloExacto = true;
+                    } else {
+                        enSinopsis = true;
+                    }
+                }
+                int puntaje = 0;
+                if (enTitulo) {
+                    puntaje += 3;
+                    if (tituloExacto)
+                        puntaje += 50;
+                }
+                if (enSinopsis)
+                    puntaje += 2;
+                resultados.push_back(make_pair(&peliculas[maxPelicula], puntaje));
+            }
+            for (size_t k = 0; k < listas.size(); k++)
+                cursores[k]++;
+        }
+    }
+};
+
+// Indica si la consulta esta entre comillas dobles; en ese caso devuelve la frase sin comillas.
+bool esConsultaFrase(const string &consulta, string &frase) {
+    string limpia = normalizarEspacios(consulta);
+    if (limpia.size() < 2 || limpia.front() != '\"' || limpia.back() != '\"')
+        return false;
+    frase = limpia.substr(1, limpia.size() - 2);
+    return true;
+}
+
+// -------------------- RECLAMACION POR EPOCAS (RCU) --------------------
+// Cada hilo lector anuncia en una ranura la epoca en la que empezo a leer. Quien publica una
+// version nueva cambia el puntero, avanza la epoca y libera la version anterior solo cuando ya no
+// queda ningun lector anunciado en una epoca igual o anterior. Los lectores nunca esperan: si
+// todas las ranuras estan ocupadas se agrega otro bloque de ranuras a la lista (no se liberan
+// hasta el final del programa, asi recorrerla no necesita candados).
+class DominioEpocas {
+public:
+    static const int RANURAS_POR_BLOQUE = 256;
+private:
+    struct BloqueRanuras {
+        atomic<uint64_t> ranuras[RANURAS_POR_BLOQUE];   // 0: sin lectura activa
+        atomic<bool> ocupadas[RANURAS_POR_BLOQUE];
+        atomic<BloqueRanuras*> siguiente{nullptr};
+        BloqueRanuras() {
+            for (int i = 0; i < RANURAS_POR_BLOQUE; i++) {
+                ranuras[i] = 0;
+                ocupadas[i] = false;
+            }
+        }
+    };
+    atomic<uint64_t> epocaGlobal{1};
+    BloqueRanuras primero;
+    mutex mutexCrecer;
+
+    struct RegistroHilo {
+        BloqueRanuras* bloque = nullptr;
+        int ranura = -1;
+        int profundidad = 0;   // Permite lecturas anidadas en el mismo hilo
+        ~RegistroHilo() {
+            if (bloque)
+                bloque->ocupadas[ranura] = false;
+        }
+    };
+
+    static RegistroHilo& registro() {
+        static thread_local RegistroHilo reg;
+        return reg;
+    }
+
+    void reservarRanura(BloqueRanuras* &reservado, int &ranura) {
+        BloqueRanuras* bloque = &primero;
+        while (true) {
+            for (int i = 0; i < RANURAS_POR_BLOQUE; i++) {
+                bool libre = false;
+                if (bloque->ocupadas[i].compare_exchange_strong(libre, true)) {
+                    reservado = bloque;
+                    ranura = i;
+                    return;
+                }
+            }
+            BloqueRanuras* siguiente = bloque->siguiente.load();
+            if (!siguiente) {
+                lock_guard<mutex> lk(mutexCrecer);
+                siguiente = bloque->siguiente.load();
+                if (!siguiente) {
+                    siguiente = new BloqueRanuras();
+                    bloque->siguiente.store(siguiente);
+                }
+            }
+            bloque = siguiente;
+        }
+    }
+
+public:
+    DominioEpocas() = default;
+    ~DominioEpocas() {
+        for (BloqueRanuras* b = primero.siguiente.load(); b;) {
+            BloqueRanuras* siguiente = b->siguiente.load();
+            delete b;
+            b = siguiente;
+        }
+    }
+
+    static DominioEpocas& global() {
+        static DominioEpocas dominio;
+        return dominio;
+    }
+
+    void entrar() {
+        RegistroHilo &reg = registro();
+        if (!reg.bloque)
+            reservarRanura(reg.bloque, reg.ranura);
+        if (reg.profundidad++ == 0)
+            reg.bloque->ranuras[reg.ranura].store(epocaGlobal.load());
+    }
+
+    void salir() {
+        RegistroHilo &reg = registro();
+        if (--reg.profundidad == 0)
+            reg.bloque->ranuras[reg.ranura].store(0);
+    }
+
+    // Lectura que no queda atada al hilo: una corrutina puede empezarla en un hilo del pool y
+    // terminarla en otro, asi que usa una ranura propia en vez de la del hilo.
+    struct RanuraLector {
+        BloqueRanuras* bloque = nullptr;
+        int ranura = -1;
+    };
+
+    RanuraLector entrarDesacoplado() {
+        RanuraLector lector;
+        reservarRanura(lector.bloque, lector.ranura);
+        lector.bloque->ranuras[lector.ranura].store(epocaGlobal.load());
+        return lector;
+    }
+
+    void salirDesacoplado(const RanuraLector &lector) {
+        lector.bloque->ranuras[lector.ranura].store(0);
+        lector.bloque->ocupadas[lector.ranura] = false;
+    }
+
+    // Avanza la epoca y devuelve la anterior.
+    uint64_t avanzarEpoca() {
+        return epocaGlobal.fetch_add(1);
+    }
+
+    bool hayLectoresDesde(uint64_t epoca) const {
+        for (const BloqueRanuras* b = &primero; b; b = b->siguiente.load())
+            for (int i = 0; i < RANURAS_POR_BLOQUE; i++) {
+                uint64_t e = b->ranuras[i].load();
+                if (e != 0 && e <= epoca)
+                    return true;
+            }
+        return false;
+    }
+};
+
+// Publica versiones inmutables de T. leer() da acceso a la version vigente mientras viva la
+// Lectura; publicar() reemplaza la version con un cambio atomico de puntero y libera la anterior
+// cuando ya nadie la lee. No se debe publicar desde un hilo que tenga una Lectura abierta.
+template<typename T>
+class PublicadorRCU {
+private:
+    atomic<T*> actual{nullptr};
+    mutex mutexPublicar;
+public:
+    class Lectura {
+    private:
+        T* dato;
+    public:
+        explicit Lectura(const PublicadorRCU<T> &publicador) {
+            DominioEpocas::global().entrar();
+            dato = publicador.actual.load();
+        }
+        ~Lectura() {
+            DominioEpocas::global().salir();
+        }
+        Lectura(const Lectura&) = delete;
+        Lectura& operator=(const Lectura&) = delete;
+        T* operator->() const { return dato; }
+        T& operator*() const { return *dato; }
+    };
+
+    // Como Lectura, pero se puede mantener a traves de un co_await que reanude en otro hilo.
+    class LecturaDesacoplada {
+    private:
+        DominioEpocas::RanuraLector lector;
+        T* dato;
+    public:
+        explicit LecturaDesacoplada(const PublicadorRCU<T> &publicador) {
+            lector = DominioEpocas::global().entrarDesacoplado();
+            dato = publicador.actual.load();
+        }
+        ~LecturaDesacoplada() {
+            DominioEpocas::global().salirDesacoplado(lector);
+        }
+        LecturaDesacoplada(const LecturaDesacoplada&) = delete;
+        LecturaDesacoplada& operator=(const LecturaDesacoplada&) = delete;
+        T* operator->() const { return dato; }
+        T& operator*() const { return *dato; }
+    };
+
+    ~PublicadorRCU() {
+        delete actual.load();
+    }
+
+    Lectura leer() const {
+        return Lectura(*this);
+    }
+
+    LecturaDesacoplada leerDesacoplado() const {
+        return LecturaDesacoplada(*this);
+    }
+
+    void publicar(unique_ptr<T> nueva) {
+        publicar(move(nueva), [](T&, T&) {});
+    }
+
+    // Igual, pero antes de liberar la version anterior (ya sin lectores) llama a
+    // antesDeLiberar(anterior, publicada).
+    template<typename Funcion>
+    void publicar(unique_ptr<T> nueva, Funcion antesDeLiberar) {
+        lock_guard<mutex> lk(mutexPublicar);
+        T* publicada = nueva.get();
+        T* anterior = actual.exchange(nueva.release());
+        uint64_t epoca = DominioEpocas::global().avanzarEpoca();
+        while (DominioEpocas::global().hayLectoresDesde(epoca))
+            this_thread::sleep_for(chrono::milliseconds(1));
+        if (anterior)
+            antesDeLiberar(*anterior, *publicada);
+        delete anterior;
+    }
+};
+
+// -------------------- MEMORIA DE LOS INDICES --------------------
+void reportarMemoria(ReporteMemoria &reporte, const vector<Pelicula> &peliculas) {
+    size_t textos = 0, etiquetas = 0, numEtiquetas = 0;
+    for (const Pelicula &p : peliculas) {
+        textos += memoriaCadena(p.id) + memoriaCadena(p.titulo) + memoriaCadena(p.sinopsis) + memoriaCadena(p.fuente);
+        etiquetas += memoriaVector(p.etiquetas);
+        for (const string &e : p.etiquetas)
+            etiquetas += memoriaCadena(e);
+        numEtiquetas += p.etiquetas.size();
+    }
+    reporte.push_back({"Catalogo: peliculas", memoriaVector(peliculas) + textos, peliculas.size()});
+    reporte.push_back({"Catalogo: etiquetas", etiquetas, numEtiquetas});
+}
+
+void reportarMemoria(ReporteMemoria &reporte, const IndicePalabras &indice) {
+    size_t bytes = memoriaTablaHash(indice.postings), posiciones = 0, numPostings = 0;
+    for (const auto &par : indice.postings) {
+        bytes += memoriaCadena(par.first) + memoriaVector(par.second.postings);
+        numPostings += par.second.postings.size();
+        posiciones += memoriaVector(par.second.posiciones);
+    }
+    reporte.push_back({"Indice de palabras: postings", bytes + memoriaVector(indice.tokensTitulo), indice.postings.size()});
+    reporte.push_back({"Indice de palabras: posiciones", posiciones, numPostings});
+}
+
+void reportarMemoria(ReporteMemoria &reporte, const IndiceEtiquetas &indice) {
+    size_t bytes = memoriaTablaHash(indice.postings) + memoriaVector(indice.vocabulario), numPostings = 0;
+    for (const auto &par : indice.postings) {
+        bytes += memoriaCadena(par.first) + memoriaVector(par.second);
+        numPostings += par.second.size();
+    }
+    for (const string &etiqueta : indice.vocabulario)
+        bytes += memoriaCadena(etiqueta);
+    size_t trigramas = memoriaTablaHash(indice.trigramas);
+    for (const auto &par : indice.trigramas)
+        trigramas += memoriaVector(par.second);
+    reporte.push_back({"Indice de etiquetas: postings", bytes, numPostings});
+    reporte.push_back({"Indice de etiquetas: bitmaps", memoriaVector(indice.bitmaps), indice.vocabulario.size()});
+    reporte.push_back({"Indice de etiquetas: trigramas", trigramas, indice.trigramas.size()});
+}
+
+void reportarMemoria(ReporteMemoria &reporte, const IndiceMinHash &indice) {
+    size_t baldes = memoriaVector(indice.baldes), entradas = 0;
+    for (const auto &banda : indice.baldes) {
+        baldes += memoriaVector(banda);
+        entradas += banda.size();
+    }
+    reporte.push_back({"MinHash: firmas", memoriaVector(indice.firmas) + memoriaVector(indice.conFirma), indice.firmas.size()});
+    reporte.push_back({"MinHash: baldes LSH", baldes, entradas});
+}
+
+void reportarMemoria(ReporteMemoria &reporte, const IndiceSimilitud &indice) {
+    reporte.push_back({"TF-IDF: vectores", memoriaVector(indice.inicio) + memoriaVector(indice.terminos) +
+                       memoriaVector(indice.pesos) + memoriaVector(indice.huellaTermino), indice.terminos.size()});
+    reporte.push_back({"TF-IDF: vecinos", memoriaVector(indice.vecinos) + memoriaVector(indice.similitudVecinos),
+                       indice.vecinos.size()});
+}
+
+void reportarMemoria(ReporteMemoria &reporte, const ModeloFactores &modelo) {
+    reporte.push_back({"Factores CF", memoriaVector(modelo.factores) + memoriaVector(modelo.conFactor) +
+                       memoriaVector(modelo.gramiana), modelo.factores.size()});
+}
+
+// -------------------- INSTANTANEA DEL CATALOGO --------------------
+// Catalogo y todos sus indices para una version dada. Una vez construida no se modifica
+// (salvo en el modo interactivo, que es de un solo usuario y no recarga).
+struct InstantaneaCatalogo {
+    uint64_t version;
+    shared_ptr<vector<Pelicula>> datos;
+    vector<Pelicula> &peliculas;
+    IndicePalabras indicePalabras;
+    IndiceEtiquetas indiceEtiquetas;
+    IndiceMinHash minhash;
+    IndiceSimilitud similitud;
+    IndiceHNSW hnsw;
+    ModeloFactores factores;                   // Vacio si no se paso --factores
+    ContadoresPopularidad popularidad;
+    IndiceAutocompletado autocompletado;
+    unique_ptr<ArbolSufijosUkkonen> arbol;
+    unordered_map<string, int> indicePorId;    // imdb_id -> posicion en peliculas
+
+    InstantaneaCatalogo(uint64_t version, shared_ptr<vector<Pelicula>> d)
+      : version(version), datos(move(d)), peliculas(*datos), popularidad(peliculas.size()) {
+        indicePalabras = construirIndice(peliculas);
+        indiceEtiquetas = construirIndiceEtiquetas(peliculas);
+        minhash = construirIndiceMinHash(peliculas);
+        similitud = construirIndiceSimilitud(peliculas, &minhash);
+        vector<float> vectores = construirVectoresDensos(peliculas, similitud);
+        if (archivoIndiceHNSW.empty() || !hnsw.cargar(archivoIndiceHNSW, vectores)) {
+            hnsw.construir(move(vectores));
+            if (!archivoIndiceHNSW.empty() && !hnsw.guardar(archivoIndiceHNSW))
+                cerr << "No se pudo guardar el indice HNSW en " << archivoIndiceHNSW << endl;
+        }
+        // Construir el arbol de sufijos usando Ukkonen
+        vector<uint32_t> inicioPeliculas;
+        string textoGlobal = construirTextoGlobal(peliculas, inicioPeliculas);
+        arbol = make_unique<ArbolSufijosUkkonen>(move(textoGlobal), move(inicioPeliculas));
+        // Construir el indice de autocompletado de titulos
+        autocompletado.construir(peliculas, &popularidad);
+        popularidad.observarConsolidacion([this](const vector<int> &cambiadas) {
+            autocompletado.actualizarPopularidad(cambiadas);
+        });
+        for (int i = 0; i < (int)peliculas.size(); i++)
+            indicePorId.emplace(peliculas[i].id, i);
+        if (!archivoFactoresCF.empty() && !cargarModeloFactores(archivoFactoresCF, indicePorId, peliculas.size(), factores))
+            cerr << "No se pudieron cargar los factores de " << archivoFactoresCF << endl;
+    }
+
+    ~InstantaneaCatalogo() {
+        // El consolidador no debe tocar el autocompletado mientras se destruye.
+        popularidad.observarConsolidacion(nullptr);
+    }
+
+    int buscarPorId(const string &id) const {
+        auto it = indicePorId.find(id);
+        return it == indicePorId.end() ? -1 : it->second;
+    }
+
+    // Una fila por parte de cada estructura de la instantanea.
+    ReporteMemoria memoria() const {
+        ReporteMemoria reporte;
+        reportarMemoria(reporte, peliculas);
+        reportarMemoria(reporte, indicePalabras);
+        reportarMemoria(reporte, indiceEtiquetas);
+        reportarMemoria(reporte, minhash);
+        reportarMemoria(reporte, similitud);
+        hnsw.reportarMemoria(reporte);
+        reportarMemoria(reporte, factores);
+        popularidad.reportarMemoria(reporte);
+        autocompletado.reportarMemoria(reporte);
+        if (arbol)
+            arbol->reportarMemoria(reporte);
+        size_t bytesIds = memoriaTablaHash(indicePorId);
+        for (const auto &par : indicePorId)
+            bytesIds += memoriaCadena(par.first);
+        reporte.push_back({"Indice por imdb_id", bytesIds, indicePorId.size()});
+        return reporte;
+    }
+
+    // Copia los likes y vistas acumulados en otra instantanea (por imdb_id) y reordena el
+    // autocompletado. Se llama antes de publicar esta instantanea; devuelve los totales copiados
+    // (por posicion en la anterior) para ponerAlDiaPopularidad.
+    vector<pair<int64_t, int64_t>> heredarPopularidad(InstantaneaCatalogo &anterior) {
+        anterior.popularidad.consolidar();
+        vector<pair<int64_t, int64_t>> copiados(anterior.peliculas.size());
+        for (size_t j = 0; j < copiados.size(); j++)
+            copiados[j] = make_pair(anterior.popularidad.likes(j), anterior.popularidad.vistas(j));
+        for (int i = 0; i < (int)peliculas.size(); i++) {
+            int j = anterior.buscarPorId(peliculas[i].id);
+            if (j != -1)
+                popularidad.fijar(i, copiados[j].first, copiados[j].second);
+        }
+        autocompletado.recalcularTodo();
+        return copiados;
+    }
+
+    // Suma los likes y vistas que recibio la anterior despues de heredarPopularidad. Se llama ya
+    // publicada esta instantanea, cuando la anterior no tiene lectores (no recibira mas).
+    void ponerAlDiaPopularidad(InstantaneaCatalogo &anterior, const vector<pair<int64_t, int64_t>> &copiados) {
+        anterior.popularidad.consolidar();
+        vector<int> cambiadas;
+        for (int i = 0; i < (int)peliculas.size(); i++) {
+            int j = anterior.buscarPorId(peliculas[i].id);
+            if (j == -1)
+                continue;
+            int64_t likes = anterior.popularidad.likes(j) - copiados[j].first;
+            int64_t vistas = anterior.popularidad.vistas(j) - copiados[j].second;
+            if (likes || vistas) {
+                popularidad.sumarTotales(i, likes, vistas);
+                cambiadas.push_back(i);
+            }
+        }
+        if (!cambiadas.empty())
+            autocompletado.actualizarPopularidad(cambiadas);
+    }
+};
+
+// Elige la estrategia segun el modo (y si la consulta es una frase entre comillas) y busca.
+// Solo lee el catalogo y los indices, por lo que se puede llamar desde varios hilos a la vez.
+vector<pair<Pelicula*, int>> ejecutarBusqueda(InstantaneaCatalogo &catalogo, const string &consulta, int modo,
+                                              const MemoriaLote* lote = nullptr) {
+    string frase;
+    bool busquedaFrase = (modo == 1 && esConsultaFrase(consulta, frase));
+    EstrategiaTituloSinopsis estrategiaTexto(catalogo.arbol.get(), true, lote);
+    EstrategiaFrase estrategiaFrase(catalogo.indicePalabras);
+    EstrategiaEtiqueta estrategiaEtiqueta(catalogo.indiceEtiquetas, lote);
+    EstrategiaBusqueda* estrategia;
+    if (modo != 1)
+        estrategia = &estrategiaEtiqueta;
+    else if (busquedaFrase)
+        estrategia = &estrategiaFrase;
+    else
+        estrategia = &estrategiaTexto;
+    return estrategia->buscar(catalogo.peliculas, busquedaFrase ? frase : consulta);
+}
+
+// Igual que ejecutarBusqueda, pero como corrutina: las estrategias viven en el marco de la
+// corrutina hasta que termina su buscarAsync. El catalogo debe seguir vivo mientras tanto.
+Tarea<vector<pair<Pelicula*, int>>> ejecutarBusquedaAsync(InstantaneaCatalogo &catalogo, string consulta, int modo) {
+    string frase;
+    bool busquedaFrase = (modo == 1 && esConsultaFrase(consulta, frase));
+    EstrategiaTituloSinopsis estrategiaTexto(catalogo.arbol.get(), true);
+    EstrategiaFrase estrategiaFrase(catalogo.indicePalabras);
+    EstrategiaEtiqueta estrategiaEtiqueta(catalogo.indiceEtiquetas);
+    EstrategiaBusqueda* estrategia;
+    if (modo != 1)
+        estrategia = &estrategiaEtiqueta;
+    else if (busquedaFrase)
+        estrategia = &estrategiaFrase;
+    else
+        estrategia = &estrategiaTexto;
+    co_return co_await estrategia->buscarAsync(catalogo.peliculas, busquedaFrase ? frase : consulta);
+}
+
+// -------------------- CACHE DE RESULTADOS DE BUSQUEDA --------------------
+// LRU acotada en bytes. La clave es el modo mas la consulta normalizada (minusculas y espacios
+// simples) y el valor son todos los resultados sin ordenar (posicion de la pelicula y puntaje)
+// de una version concreta del catalogo. Al ver una version mas nueva se vacia entera: los
+// resultados viejos apuntan a posiciones de otra instantanea. Un unico mutex basta: el trabajo
+// bajo el candado es mover un nodo de la lista y copiar los resultados, mucho menos que buscar.
+class CacheConsultas {
+public:
+    struct Estadisticas {
+        uint64_t aciertos = 0;
+        uint64_t fallos = 0;
+        uint64_t invalidaciones = 0;   // Entradas descartadas por cambio de version
+        size_t entradas = 0;
+        size_t bytes = 0;
+        size_t capacidadBytes = 0;
+    };
+private:
+    struct Entrada {
+        string clave;
+        vector<pair<int, int>> ranking;
+        size_t bytes;
+    };
+    size_t capacidadBytes;
+    list<Entrada> lru;   // Mas reciente al frente
+    unordered_map<string, list<Entrada>::iterator> porClave;
+    uint64_t versionActual = 0;
+    Estadisticas estad;
+    mutable mutex m;
+
+    static size_t tamanoEntrada(const string &clave, size_t largoRanking) {
+        return sizeof(Entrada) + clave.capacity() + largoRanking * sizeof(pair<int, int>) +
+               sizeof(pair<const string, list<Entrada>::iterator>) + 2 * sizeof(void*);
+    }
+
+    // Vacia la cache si llega una version mas nueva. Devuelve false si la version es vieja.
+    bool alinearVersion(uint64_t version) {
+        if (version < versionActual)
+            return false;
+        if (version > versionActual) {
+            estad.invalidaciones += lru.size();
+            lru.clear();
+            porClave.clear();
+            estad.bytes = 0;
+            versionActual = version;
+        }
+        return true;
+    }
+
+public:
+    explicit CacheConsultas(size_t capacidadBytes) : capacidadBytes(capacidadBytes) {}
+
+    static string clave(const string &consultaNormalizada, int modo) {
+        return to_string(modo) + "|" + consultaNormalizada;
+    }
+
+    bool obtener(const string &clave, uint64_t version, vector<pair<int, int>> &ranking) {
+        lock_guard<mutex> lk(m);
+        auto it = alinearVersion(version) ? porClave.find(clave) : porClave.end();
+        if (it == porClave.end()) {
+            estad.fallos++;
+            return false;
+        }
+        lru.splice(lru.begin(), lru, it->second);
+        ranking = it->second->ranking;
+        estad.aciertos++;
+        return true;
+    }
+
+    void guardar(const string &clave, uint64_t version, vector<pair<int, int>> ranking) {
+        size_t bytes = tamanoEntrada(clave, ranking.size());
+        lock_guard<mutex> lk(m);
+        if (bytes > capacidadBytes || !alinearVersion(version) || porClave.count(clave))
+            return;
+        lru.push_front(Entrada{clave, move(ranking), bytes});
+        porClave[clave] = lru.begin();
+        estad.bytes += bytes;
+        while (estad.bytes > capacidadBytes) {
+            Entrada &ultima = lru.back();
+            estad.bytes -= ultima.bytes;
+            porClave.erase(ultima.clave);
+            lru.pop_back();
+        }
+    }
+
+    Estadisticas estadisticas() const {
+        lock_guard<mutex> lk(m);
+        Estadisticas copia = estad;
+        copia.entradas = lru.size();
+        copia.capacidadBytes = capacidadBytes;
+        return copia;
+    }
+};
+
+CacheConsultas cacheConsultas(CAPACIDAD_CACHE_CONSULTAS);
+
+// Resultados guardados para la clave en esta version del catalogo, con punteros a sus peliculas.
+bool obtenerDeCache(InstantaneaCatalogo &catalogo, const string &clave, vector<pair<Pelicula*, int>> &resultados) {
+    vector<pair<int, int>> ranking;
+    if (!cacheConsultas.obtener(clave, catalogo.version, ranking))
+        return false;
+    resultados.reserve(ranking.size());
+    for (auto &[id, puntaje] : ranking)
+        resultados.push_back(make_pair(&catalogo.peliculas[id], puntaje));
+    return true;
+}
+
+void guardarEnCache(InstantaneaCatalogo &catalogo, const string &clave, const vector<pair<Pelicula*, int>> &resultados) {
+    vector<pair<int, int>> ranking;
+    ranking.reserve(resultados.size());
+    for (auto &[pelicula, puntaje] : resultados)
+        ranking.push_back(make_pair((int)(pelicula - catalogo.peliculas.data()), puntaje));
+    cacheConsultas.guardar(clave, catalogo.version, move(ranking));
+}
+
+// Busca pasando por la cache. La consulta se normaliza antes de buscar, asi todas las formas que
+// comparten clave devuelven lo mismo. Se guardan los resultados sin ordenar: tanto en un fallo
+// como en un acierto el cursor ordena solo las paginas que se piden (partial_sort), y como el
+// orden del cursor es total, las paginas salen iguales venga o no de la cache.
+CursorResultados buscarConCache(InstantaneaCatalogo &catalogo, const string &consulta, int modo) {
+    string normalizada = normalizarEspacios(aMinusculas(consulta));
+    string clave = CacheConsultas::clave(normalizada, modo);
+    vector<pair<Pelicula*, int>> resultados;
+    if (!obtenerDeCache(catalogo, clave, resultados)) {
+        resultados = ejecutarBusqueda(catalogo, normalizada, modo);
+        guardarEnCache(catalogo, clave, resultados);
+    }
+    return CursorResultados(move(resultados));
+}
+
+// Igual que buscarConCache, pero en un fallo la busqueda corre en etapas sobre el pool (modo servidor).
+Tarea<CursorResultados> buscarConCacheAsync(InstantaneaCatalogo &catalogo, string consulta, int modo) {
+    string normalizada = normalizarEspacios(aMinusculas(consulta));
+    string clave = CacheConsultas::clave(normalizada, modo);
+    vector<pair<Pelicula*, int>> resultados;
+    if (!obtenerDeCache(catalogo, clave, resultados)) {
+        resultados = co_await ejecutarBusquedaAsync(catalogo, normalizada, modo);
+        guardarEnCache(catalogo, clave, resultados);
+    }
+    co_return CursorResultados(move(resultados));
+}
+
+string resumenCacheConsultas() {
+    CacheConsultas::Estadisticas e = cacheConsultas.estadisticas();
+    uint64_t consultas = e.aciertos + e.fallos;
+    ostringstream oss;
+    oss << "Cache de consultas: " << e.aciertos << " aciertos, " << e.fallos << " fallos ("
+        << (consultas ? 100.0 * e.aciertos / consultas : 0.0) << "% de aciertos), " << e.entradas
+        << " entradas, " << e.bytes / 1024 << " KB de " << e.capacidadBytes / 1024 << " KB.";
+    return oss.str();
+}
+
 // -------------------- PATRON OBSERVER: OBSERVADOR DE RECOMENDACIONES --------------------
+// El sujeto avisa cada like o unlike a sus observadores; el observador de recomendaciones solo
+// recalcula lo que cambia con ese evento en lugar de recorrer todo el catalogo.
+struct EventoGustada {
+    Pelicula* pelicula;
+    bool gusta;   // true: like, false: se quito el like
+};
+
 class Observador {
 public:
-    virtual void actualizar() = 0;
+    virtual void actualizar(const EventoGustada &evento) = 0;
+    virtual ~Observador() {}
+};
+
+class SujetoGustadas {
+private:
+    vector<Observador*> observadores;
+public:
+    void suscribir(Observador* observador) {
+        observadores.push_back(observador);
+    }
+    void notificar(const EventoGustada &evento) {
+        for (Observador* observador : observadores)
+            observador->actualizar(evento);
+    }
+};
+
+SujetoGustadas sujetoGustadas;   // Likes del modo interactivo
+
+// Mismo puntaje que recomendarPeliculas (etiquetas en comun con las peliculas gustadas), pero
+// mantenido por eventos. Por cada etiqueta se cuenta cuantas gustadas la tienen; solo cuando ese
+// contador pasa de 0 a 1 (o de 1 a 0) cambia el puntaje de las peliculas de su lista en el indice.
+// Las no gustadas con puntaje > 0 viven en un set ordenado por puntaje, que da el top-k.
+class RecomendadorIncremental {
+private:
+    const IndiceEtiquetas &indice;
+    const ContadoresPopularidad* popularidad;
+    vector<vector<int>> etiquetasDePelicula;   // Ids de etiqueta de cada pelicula (se llenan al usarse)
+    vector<int> gustadasPorEtiqueta;
+    vector<int> puntaje;
+    vector<char> gustada;
+    set<pair<int, int>> ranking;               // (-puntaje, pelicula)
+
+    const vector<int>& etiquetasDe(const vector<Pelicula> &peliculas, int pelicula) {
+        vector<int> &ids = etiquetasDePelicula[pelicula];
+        if (ids.empty()) {
+            for (auto &etiqueta : peliculas[pelicula].etiquetas) {
+                int id = indice.idEtiqueta(aMinusculas(etiqueta));
+                if (id != -1 && find(ids.begin(), ids.end(), id) == ids.end())
+                    ids.push_back(id);
+            }
+        }
+        return ids;
+    }
+
+    bool enRanking(int pelicula) const {
+        return !gustada[pelicula] && puntaje[pelicula] > 0;
+    }
+
+    void sumarPuntaje(int pelicula, int delta) {
+        if (enRanking(pelicula))
+            ranking.erase(make_pair(-puntaje[pelicula], pelicula));
+        puntaje[pelicula] += delta;
+        if (enRanking(pelicula))
+            ranking.insert(make_pair(-puntaje[pelicula], pelicula));
+    }
+
+    void cambiarEtiqueta(int etiqueta, int delta) {
+        int antes = gustadasPorEtiqueta[etiqueta];
+        gustadasPorEtiqueta[etiqueta] += delta;
+        if ((antes == 0) != (gustadasPorEtiqueta[etiqueta] == 0))
+            for (int pelicula : indice.postings.at(indice.vocabulario[etiqueta]))
+                sumarPuntaje(pelicula, delta);
+    }
+
+public:
+    RecomendadorIncremental(const IndiceEtiquetas &ind, const ContadoresPopularidad* pop = nullptr)
+      : indice(ind), popularidad(pop), etiquetasDePelicula(ind.numPeliculas),
+        gustadasPorEtiqueta(ind.vocabulario.size(), 0), puntaje(ind.numPeliculas, 0), gustada(ind.numPeliculas, 0) {}
+
+    void aplicar(const vector<Pelicula> &peliculas, int pelicula, bool gusta) {
+        if (pelicula < 0 || pelicula >= (int)gustada.size() || (bool)gustada[pelicula] == gusta)
+            return;
+        if (enRanking(pelicula))
+            ranking.erase(make_pair(-puntaje[pelicula], pelicula));
+        gustada[pelicula] = gusta;
+        for (int etiqueta : etiquetasDe(peliculas, pelicula))
+            cambiarEtiqueta(etiqueta, gusta ? 1 : -1);
+        if (enRanking(pelicula))
+            ranking.insert(make_pair(-puntaje[pelicula], pelicula));
+    }
+
+    // Las k mejores: por puntaje y, a igual puntaje, por popularidad y posicion. Solo se recorren
+    // los grupos de puntaje necesarios para llenar las k posiciones.
+    vector<int> mejores(size_t k) const {
+        vector<int> salida;
+        auto it = ranking.begin();
+        while (salida.size() < k && it != ranking.end()) {
+            int nivel = it->first;
+            vector<int> grupo;
+            for (; it != ranking.end() && it->first == nivel; ++it)
+                grupo.push_back(it->second);
+            size_t tomar = min(grupo.size(), k - salida.size());
+            if (popularidad) {
+                vector<pair<int64_t, int>> orden;
+                for (int pelicula : grupo)
+                    orden.push_back(make_pair(-popularidad->puntuacion(pelicula), pelicula));
+                partial_sort(orden.begin(), orden.begin() + tomar, orden.end());
+                for (size_t i = 0; i < tomar; i++)
+                    salida.push_back(orden[i].second);
+            } else {
+                salida.insert(salida.end(), grupo.begin(), grupo.begin() + tomar);
+            }
+        }
+        return salida;
+    }
 };
 
+// Ids de etiqueta (ordenados, sin repetir) de las peliculas gustadas.
+vector<int> etiquetasDeGustadas(const IndiceEtiquetas &indice, const vector<Pelicula> &peliculas,
+                                const vector<int> &gustadas) {
+    vector<int> etiquetas;
+    for (int pelicula : gustadas) {
+        if (pelicula < 0 || pelicula >= (int)indice.numPeliculas)
+            continue;
+        for (auto &etiqueta : peliculas[pelicula].etiquetas) {
+            int id = indice.idEtiqueta(aMinusculas(etiqueta));
+            if (id != -1)
+                etiquetas.push_back(id);
+        }
+    }
+    sort(etiquetas.begin(), etiquetas.end());
+    etiquetas.erase(unique(etiquetas.begin(), etiquetas.end()), etiquetas.end());
+    return etiquetas;
+}
+
+// Recomendacion sin estado por generacion de candidatos: solo visita las peliculas que aparecen en
+// las listas del indice de las etiquetas dadas. Los puntajes se acumulan en un arreglo denso
+// por hilo (se limpian solo las casillas tocadas) y las k mejores salen de un heap de tamano k.
+// Mismo orden que RecomendadorIncremental: puntaje, popularidad y posicion.
+// Se omiten las peliculas 'excluidas' (las gustadas).
+vector<int> recomendarPorConjuntoEtiquetas(const IndiceEtiquetas &indice, const vector<int> &etiquetas,
+                                           const vector<int> &excluidas, const ContadoresPopularidad* popularidad,
+                                           size_t k) {
+    static thread_local vector<int> puntaje;
+    static thread_local vector<int> tocadas;
+    if (puntaje.size() < indice.numPeliculas)
+        puntaje.assign(indice.numPeliculas, 0);
+    const int EXCLUIDA = numeric_limits<int>::min() / 2;
+    for (int pelicula : excluidas) {
+        if (pelicula < 0 || pelicula >= (int)indice.numPeliculas)
+            continue;
+        if (puntaje[pelicula] == 0)
+            tocadas.push_back(pelicula);
+        puntaje[pelicula] = EXCLUIDA;
+    }
+    for (int etiqueta : etiquetas)
+        for (int pelicula : indice.postings.at(indice.vocabulario[etiqueta])) {
+            if (puntaje[pelicula] == 0)
+                tocadas.push_back(pelicula);
+            puntaje[pelicula]++;
+        }
+    // Heap de minimos: en la cima queda la peor de las k mejores (puntaje, popularidad, -posicion).
+    using Candidata = tuple<int, int64_t, int>;
+    auto mejor = [](const Candidata &a, const Candidata &b) {
+        if (get<0>(a) != get<0>(b))
+            return get<0>(a) > get<0>(b);
+        if (get<1>(a) != get<1>(b))
+            return get<1>(a) > get<1>(b);
+        return get<2>(a) < get<2>(b);
+    };
+    priority_queue<Candidata, vector<Candidata>, decltype(mejor)> heap(mejor);
+    for (int pelicula : tocadas) {
+        int p = puntaje[pelicula];
+        puntaje[pelicula] = 0;
+        if (p <= 0 || k == 0)
+            continue;
+        if (heap.size() == k && p < get<0>(heap.top()))
+            continue;
+        Candidata candidata(p, popularidad ? popularidad->puntuacion(pelicula) : 0, pelicula);
+        if (heap.size() < k) {
+            heap.push(candidata);
+        } else if (mejor(candidata, heap.top())) {
+            heap.pop();
+            heap.push(candidata);
+        }
+    }
+    tocadas.clear();
+    vector<int> salida(heap.size());
+    for (size_t i = salida.size(); i-- > 0; heap.pop())
+        salida[i] = get<2>(heap.top());
+    return salida;
+}
+
+// Recomendacion de un usuario: etiquetas de sus gustadas y top-k sin ellas.
+vector<int> recomendarPorEtiquetas(const IndiceEtiquetas &indice, const vector<Pelicula> &peliculas,
+                                   const vector<int> &gustadas, const ContadoresPopularidad* popularidad,
+                                   size_t k = RECOMENDACIONES_POR_USUARIO) {
+    return recomendarPorConjuntoEtiquetas(indice, etiquetasDeGustadas(indice, peliculas, gustadas),
+                                          gustadas, popularidad, k);
+}
+
+// Con un modelo de filtrado colaborativo cargado, las recomendaciones que faltan se toman
+// primero de los factores (lo que gusto a usuarios con gustos parecidos).
+void completarConFactores(const ModeloFactores &factores, const vector<int> &gustadas,
+                          vector<int> &recomendadas, size_t total = RECOMENDACIONES_POR_USUARIO) {
+    if (recomendadas.size() >= total || factores.dimension == 0)
+        return;
+    for (int pelicula : recomendarPorFactores(factores, gustadas, recomendadas, total - recomendadas.size()))
+        recomendadas.push_back(pelicula);
+}
+
+// Si las etiquetas no alcanzan para 5 recomendaciones (peliculas con pocas etiquetas), se
+// completan con las peliculas mas parecidas a las gustadas segun el indice HNSW.
+void completarConSimilares(const IndiceHNSW &hnsw, const vector<int> &gustadas,
+                           vector<int> &recomendadas, size_t total = RECOMENDACIONES_POR_USUARIO) {
+    if (recomendadas.size() >= total)
+        return;
+    for (int pelicula : similaresAlConjunto(hnsw, gustadas, recomendadas, total - recomendadas.size()))
+        recomendadas.push_back(pelicula);
+}
+
 class ObservadorRecomendacion : public Observador {
 private:
-    vector<Pelicula*>& gustadas;
     vector<Pelicula*>& recomendadas;
     vector<Pelicula>& peliculas;
+    RecomendadorIncremental recomendador;
+    const IndiceHNSW* hnsw;
+    const ModeloFactores* factores;
+    ListaUsuario gustadas;
 public:
-    ObservadorRecomendacion(vector<Pelicula*>& g, vector<Pelicula*>& r, vector<Pelicula>& p)
-      : gustadas(g), recomendadas(r), peliculas(p) {}
-    void actualizar() override {
-        recomendadas = recomendarPeliculas(peliculas, gustadas);
+    ObservadorRecomendacion(const ListaUsuario& g, vector<Pelicula*>& r, vector<Pelicula>& p,
+                            const IndiceEtiquetas &indice, const ContadoresPopularidad* pop = nullptr,
+                            const IndiceHNSW* h = nullptr, const ModeloFactores* f = nullptr)
+      : recomendadas(r), peliculas(p), recomendador(indice, pop), hnsw(h), factores(f) {
+        for (int pelicula : g.ids()) {
+            gustadas.agregar(pelicula);
+            recomendador.aplicar(peliculas, pelicula, true);
+        }
+        publicar();
+    }
+    void actualizar(const EventoGustada &evento) override {
+        int pelicula = evento.pelicula - peliculas.data();
+        recomendador.aplicar(peliculas, pelicula, evento.gusta);
+        if (evento.gusta)
+            gustadas.agregar(pelicula);
+        else
+            gustadas.quitar(pelicula);
+        publicar();
+    }
+    void publicar() {
+        vector<int> mejores = recomendador.mejores(RECOMENDACIONES_POR_USUARIO);
+        if (factores)
+            completarConFactores(*factores, gustadas.ids(), mejores);
+        if (hnsw)
+            completarConSimilares(*hnsw, gustadas.ids(), mejores);
+        recomendadas.clear();
+        for (int pelicula : mejores)
+            recomendadas.push_back(&peliculas[pelicula]);
     }
 };
 
-// -------------------- VARIABLE GLOBAL PARA ARBOL DE SUFIJOS --------------------
-ArbolSufijosUkkonen* arbolSufijosGlobal = nullptr;
+// -------------------- VARIABLE GLOBAL DEL MODO INTERACTIVO --------------------
+InstantaneaCatalogo* catalogoInteractivo = nullptr;   // Instantanea que usa el menu (autocompletado y popularidad)
 
 // -------------------- FUNCIONES DE IMPRESION Y MENU --------------------
 void mostrarListaTitulos(const vector<Pelicula*>& lista) {
@@ -638,7 +4157,11 @@ void mostrarListaTitulos(const vector<Pelicula*>& lista) {
     }
 }
 
-bool submenuPelicula(Pelicula* seleccionada, vector<Pelicula*>& gustadas, vector<Pelicula*>& verMasTarde) {
+bool submenuPelicula(Pelicula* seleccionada, ListaUsuario& gustadas, ListaUsuario& verMasTarde) {
+    ContadoresPopularidad &popularidad = catalogoInteractivo->popularidad;
+    size_t indice = seleccionada - catalogoInteractivo->peliculas.data();
+    popularidad.sumarVista(indice);
+    popularidad.consolidar();
     while (true) {
         cout << "\n========================================" << endl;
         cout << "       DETALLES DE LA PELICULA" << endl;
@@ -653,56 +4176,65 @@ bool submenuPelicula(Pelicula* seleccionada, vector<Pelicula*>& gustadas, vector
         cout << "Sinopsis:" << endl;
         imprimirCuadro(seleccionada->sinopsis, ANCHO);
         cout << "Fuente de la sinopsis: " << seleccionada->fuente << endl;
+        cout << "Likes: " << popularidad.likes(indice) << " | Vistas: " << popularidad.vistas(indice) << endl;
         cout << "========================================" << endl;
         cout << "\nOpciones:" << endl;
-        cout << "1. " << (find(gustadas.begin(), gustadas.end(), seleccionada) == gustadas.end() ? "Dar Like" : "Quitar Like") << endl;
-        cout << "2. " << (find(verMasTarde.begin(), verMasTarde.end(), seleccionada) == verMasTarde.end() ? "Agregar a Ver mas tarde" : "Quitar de Ver mas tarde") << endl;
-        cout << "3. Regresar al submenu" << endl;
-        cout << "4. Volver al Menu Principal" << endl;
+        cout << "1. " << (gustadas.contiene(indice) ? "Quitar Like" : "Dar Like") << endl;
+        cout << "2. " << (verMasTarde.contiene(indice) ? "Quitar de Ver mas tarde" : "Agregar a Ver mas tarde") << endl;
+        cout << "3. Ver peliculas similares" << endl;
+        cout << "4. Regresar al submenu" << endl;
+        cout << "5. Volver al Menu Principal" << endl;
         int op;
         while (true) {
-            cout << "Seleccione una opcion (1-4): " << flush;
+            cout << "Seleccione una opcion (1-5): " << flush;
             cin >> op;
-            if (cin.fail() || op < 1 || op > 4) {
+            if (cin.fail() || op < 1 || op > 5) {
                 cin.clear();
                 cin.ignore(numeric_limits<streamsize>::max(), '\n');
-                cout << "Ingrese un numero entre 1 y 4." << endl;
+                cout << "Ingrese un numero entre 1 y 5." << endl;
             } else {
                 cin.ignore(numeric_limits<streamsize>::max(), '\n');
                 break;
             }
         }
-        if (op == 4)
+        if (op == 5)
             return true;
-        if (op == 3)
+        if (op == 4)
             return false;
+        if (op == 3) {
+            vector<Pelicula*> similares;
+            for (int pelicula : peliculasSimilares(catalogoInteractivo->similitud, indice))
+                similares.push_back(&catalogoInteractivo->peliculas[pelicula]);
+            if (manejarLista(similares, "Similares a " + seleccionada->titulo, gustadas, verMasTarde))
+                return true;
+        }
         if (op == 1) {
-            if (find(gustadas.begin(), gustadas.end(), seleccionada) == gustadas.end()){
-                seleccionada->likes = 1;
-                gustadas.push_back(seleccionada);
+            if (gustadas.alternar(indice)) {
+                popularidad.sumarLike(indice, 1);
+                popularidad.consolidar();
+                sujetoGustadas.notificar(EventoGustada{seleccionada, true});
                 cout << "Like anadido a " << seleccionada->titulo << "!" << endl;
             } else {
-                gustadas.erase(remove(gustadas.begin(), gustadas.end(), seleccionada), gustadas.end());
-                seleccionada->likes = 0;
+                popularidad.sumarLike(indice, -1);
+                popularidad.consolidar();
+                sujetoGustadas.notificar(EventoGustada{seleccionada, false});
                 cout << "Like removido de " << seleccionada->titulo << "." << endl;
             }
         }
         if (op == 2) {
-            if (find(verMasTarde.begin(), verMasTarde.end(), seleccionada) == verMasTarde.end()){
-                verMasTarde.push_back(seleccionada);
+            if (verMasTarde.alternar(indice))
                 cout << seleccionada->titulo << " agregada a Ver mas tarde." << endl;
-            } else {
-                verMasTarde.erase(remove(verMasTarde.begin(), verMasTarde.end(), seleccionada), verMasTarde.end());
+            else
                 cout << seleccionada->titulo << " removida de Ver mas tarde." << endl;
-            }
         }
     }
 }
 
-void manejarLista(const vector<Pelicula*>& lista, const string &nombreLista, vector<Pelicula*>& gustadas, vector<Pelicula*>& verMasTarde) {
+// Devuelve true si el usuario eligio volver al menu principal desde el detalle de una pelicula.
+bool manejarLista(const vector<Pelicula*>& lista, const string &nombreLista, ListaUsuario& gustadas, ListaUsuario& verMasTarde) {
     if (lista.empty()){
         cout << "\nNo hay peliculas en " << nombreLista << "." << endl;
-        return;
+        return false;
     }
     cout << "\n--- " << nombreLista << " (solo titulos) ---" << endl;
     mostrarListaTitulos(lista);
@@ -720,20 +4252,26 @@ void manejarLista(const vector<Pelicula*>& lista, const string &nombreLista, vec
         }
     }
     if (indice == 0)
-        return;
-    bool volver = submenuPelicula(lista[indice - 1], gustadas, verMasTarde);
-    if (volver)
-        return;
+        return false;
+    return submenuPelicula(lista[indice - 1], gustadas, verMasTarde);
+}
+
+void manejarAutocompletado(const string &prefijo, ListaUsuario& gustadas, ListaUsuario& verMasTarde) {
+    auto inicio = chrono::high_resolution_clock::now();
+    vector<Pelicula*> sugerencias = catalogoInteractivo->autocompletado.completar(prefijo);
+    auto fin = chrono::high_resolution_clock::now();
+    chrono::duration<double, micro> tiempo = fin - inicio;
+    cout << "Tiempo de autocompletado: " << tiempo.count() << " microsegundos." << endl;
+    manejarLista(sugerencias, "Sugerencias para \"" + prefijo + "\"", gustadas, verMasTarde);
 }
 
-void manejarBusqueda(vector<Pelicula>& peliculas,
-                     unordered_map<string, set<Pelicula*>> &indiceModo1,
-                     unordered_map<string, set<Pelicula*>> &indiceEtiqueta,
-                     vector<Pelicula*>& gustadas,
-                     vector<Pelicula*>& verMasTarde) {
+void manejarBusqueda(InstantaneaCatalogo &catalogo,
+                     ListaUsuario& gustadas,
+                     ListaUsuario& verMasTarde) {
     cout << "\n--- Busqueda de Peliculas ---" << endl;
     cout << "Modo actual: " << (modoBusquedaGlobal == 1 ? "Titulo y sinopsis" : "Etiqueta") << endl;
-    cout << "Ingrese 'modo' para cambiar el modo de busqueda, o ingrese su consulta: " << flush;
+    cout << "Ingrese 'modo' para cambiar el modo de busqueda, o ingrese su consulta" << endl;
+    cout << "(termine con '*' para autocompletar un titulo, por ejemplo: star wa*): " << flush;
     string consulta;
     getline(cin, consulta);
     if (aMinusculas(consulta) == "modo") {
@@ -744,102 +4282,32 @@ void manejarBusqueda(vector<Pelicula>& peliculas,
         cout << "Ingrese su consulta: " << flush;
         getline(cin, consulta);
     }
+    if (consulta.size() > 1 && consulta.back() == '*') {
+        manejarAutocompletado(consulta.substr(0, consulta.size() - 1), gustadas, verMasTarde);
+        return;
+    }
     // Guardar la busqueda en el historial (Memento)
     cuidadorHistorial.agregarMemento(MementoBusqueda(consulta, modoBusquedaGlobal));
     // Medir tiempo de busqueda
     auto inicioBusq = chrono::high_resolution_clock::now();
-    vector<pair<Pelicula*, int>> resultados;
-    if (modoBusquedaGlobal == 1) {
-        string consultaLower = aMinusculas(consulta);
-        string consultaNorm = normalizarEspacios(consultaLower);
-        set<int> indicesCoincidentes = arbolSufijosGlobal->buscar(consultaLower);
-        // Fallback: union con busqueda lineal
-        for (int i = 0; i < peliculas.size(); i++) {
-            string titLower = aMinusculas(peliculas[i].titulo);
-            string sinopLower = aMinusculas(peliculas[i].sinopsis);
-            if (titLower.find(consultaLower) != string::npos || sinopLower.find(consultaLower) != string::npos)
-                indicesCoincidentes.insert(i);
-        }
-        for (int idx : indicesCoincidentes) {
-            Pelicula &pel = peliculas[idx];
-            string titLower = aMinusculas(pel.titulo);
-            string titNorm = normalizarEspacios(titLower);
-            string sinopLower = aMinusculas(pel.sinopsis);
-            int puntaje = 0;
-            if (titLower.find(consultaLower) != string::npos) {
-                puntaje += 3;
-                if (titNorm == consultaNorm)
-                    puntaje += 50;
-            }
-            if (sinopLower.find(consultaLower) != string::npos)
-                puntaje += 2;
-            if (puntaje > 0)
-                resultados.push_back(make_pair(&pel, puntaje));
-        }
-    } else {
-        vector<string> etiquetasConsulta;
-        if (consulta.find(',') != string::npos) {
-            istringstream iss(consulta);
-            string token;
-            while(getline(iss, token, ',')) {
-                token = recortar(token);
-                if (!token.empty())
-                    etiquetasConsulta.push_back(aMinusculas(token));
-            }
-        } else {
-            etiquetasConsulta = tokenizar(consulta);
-        }
-        vector<future<vector<pair<Pelicula*, int>>>> futuros;
-        size_t total = peliculas.size();
-        size_t numHilos = NUM_HILOS;
-        size_t tamBloque = total / numHilos;
-        for (size_t i = 0; i < numHilos; i++) {
-            size_t inicio = i * tamBloque;
-            size_t fin = (i == numHilos - 1) ? total : (i + 1) * tamBloque;
-            futuros.push_back(async(launch::async, [&, inicio, fin, etiquetasConsulta]() {
-                vector<pair<Pelicula*, int>> parcial;
-                for (size_t j = inicio; j < fin; j++) {
-                    Pelicula& pel = peliculas[j];
-                    bool valido = true;
-                    for (auto &qt : etiquetasConsulta) {
-                        bool encontrado = false;
-                        for (auto &etiqueta : pel.etiquetas) {
-                            if (aMinusculas(etiqueta).find(qt) != string::npos) {
-                                encontrado = true;
-                                break;
-                            }
-                        }
-                        if (!encontrado) {
-                            valido = false;
-                            break;
-                        }
-                    }
-                    if (valido)
-                        parcial.push_back(make_pair(&pel, 5));
-                }
-                return parcial;
-            }));
-        }
-        for (auto &fut : futuros) {
-            vector<pair<Pelicula*, int>> parcial = fut.get();
-            resultados.insert(resultados.end(), parcial.begin(), parcial.end());
-        }
-    }
+    string frase;
+    bool busquedaFrase = (modoBusquedaGlobal == 1 && esConsultaFrase(consulta, frase));
+    CursorResultados cursor = buscarConCache(catalogo, consulta, modoBusquedaGlobal);
     auto finBusq = chrono::high_resolution_clock::now();
     chrono::duration<double> tiempoBusq = finBusq - inicioBusq;
     cout << "Tiempo de busqueda: " << tiempoBusq.count() << " segundos." << endl;
-    if (resultados.empty()) {
+    if (cursor.total() == 0) {
         cout << "\nNo se encontraron peliculas para la consulta." << endl;
         return;
     }
-    sort(resultados.begin(), resultados.end(), [](auto &a, auto &b){ return a.second > b.second; });
-    int totalPaginas = (resultados.size() + 4) / 5;
+    int totalPaginas = cursor.totalPaginas();
     int paginaActual = 0;
-    string consultaLower = aMinusculas(consulta);
+    string consultaLower = aMinusculas(busquedaFrase ? frase : consulta);
     while (true) {
         cout << "\n--- Resultados (pagina " << (paginaActual + 1) << " de " << totalPaginas << ") ---" << endl;
-        for (int i = paginaActual * 5; i < min((int)resultados.size(), (paginaActual + 1) * 5); i++) {
-            Pelicula* p = resultados[i].first;
+        vector<pair<Pelicula*, int>> pagina = cursor.pagina(paginaActual);
+        for (size_t k = 0; k < pagina.size(); k++) {
+            Pelicula* p = pagina[k].first;
             string salida = p->titulo;
             bool encTit = (aMinusculas(p->titulo).find(consultaLower) != string::npos);
             bool encSin = (aMinusculas(p->sinopsis).find(consultaLower) != string::npos);
@@ -853,7 +4321,7 @@ void manejarBusqueda(vector<Pelicula>& peliculas,
                 string frag = extraerFragmento(p->sinopsis, consultaLower);
                 salida += " - " + frag;
             }
-            cout << to_string(i + 1) << ". " << endl;
+            cout << to_string(paginaActual * RESULTADOS_POR_PAGINA + k + 1) << ". " << endl;
             imprimirTituloJustificado(salida);
         }
         cout << "\nOpciones:" << endl;
@@ -893,11 +4361,11 @@ void manejarBusqueda(vector<Pelicula>& peliculas,
             int indiceSel;
             cin >> indiceSel;
             cin.ignore(numeric_limits<streamsize>::max(), '\n');
-            int indiceGlobal = paginaActual * 5 + indiceSel;
-            if (indiceSel < 1 || indiceSel > 5 || indiceGlobal > (int)resultados.size()) {
+            int indiceGlobal = paginaActual * RESULTADOS_POR_PAGINA + indiceSel;
+            if (indiceSel < 1 || indiceSel > RESULTADOS_POR_PAGINA || indiceGlobal > (int)cursor.total()) {
                 cout << "Seleccion invalida." << endl;
             } else {
-                bool volverMenu = submenuPelicula(resultados[indiceGlobal - 1].first, gustadas, verMasTarde);
+                bool volverMenu = submenuPelicula(cursor.obtener(indiceGlobal - 1).first, gustadas, verMasTarde);
                 if (volverMenu)
                     return;
             }
@@ -947,47 +4415,1091 @@ void manejarHistorialBusquedas() {
     }
 }
 
+// -------------------- MODO SERVIDOR (VARIAS SESIONES) --------------------
+// Se ejecuta con --servidor <puerto> (TCP en 127.0.0.1) o --servidor <ruta> (socket Unix).
+// Protocolo: cada linea que envia el cliente es un objeto JSON plano y cada respuesta es una
+// linea JSON. Todas las sesiones comparten el catalogo y los indices, que solo se leen; cada
+// sesion tiene sus propios likes, su lista "Ver mas tarde" y su historial. Los likes y las vistas
+// ("pelicula" cuenta una vista) tambien se suman a los contadores globales de popularidad.
+//   {"op":"buscar","consulta":"star war","modo":1,"pagina":0}
+//   {"op":"autocompletar","prefijo":"star wa"}
+//   {"op":"pelicula","imdb_id":"tt0111161"}
+//   {"op":"like","imdb_id":"tt0111161"}            (alterna el like)
+//   {"op":"ver_mas_tarde","imdb_id":"tt0111161"}   (alterna la pelicula en la lista)
+//   {"op":"similares","imdb_id":"tt0111161"}       (peliculas con sinopsis parecida, de la tabla kNN)
+//   {"op":"listas"}  {"op":"recomendaciones"}  {"op":"historial"}  {"op":"borrar_historial"}
+//   {"op":"version"}  {"op":"recargar"}  {"op":"cache"}  {"op":"salir"}
+// El catalogo se publica como instantaneas (RCU): "recargar" construye una nueva en segundo plano
+// y la cambia de forma atomica; las peticiones en curso terminan con la instantanea anterior.
+// Las peliculas se identifican por "imdb_id", que no cambia entre recargas. Las respuestas
+// tambien traen "id" (posicion en la instantanea) y "version"; una peticion puede usar "id" en
+// lugar de "imdb_id" solo si envia esa "version", y se rechaza si el catalogo ya se recargo.
+
+struct CatalogoCompartido {
+    PublicadorRCU<InstantaneaCatalogo> &publicador;
+    BaseDeDatos<Pelicula> &baseDeDatos;
+    atomic<bool> recargando{false};
+    atomic<uint64_t> ultimaVersion{1};
+
+    CatalogoCompartido(PublicadorRCU<InstantaneaCatalogo> &p, BaseDeDatos<Pelicula> &bd) : publicador(p), baseDeDatos(bd) {}
+
+    // Lanza la recarga en segundo plano; devuelve false si ya habia una en curso.
+    bool recargarEnSegundoPlano() {
+        bool esperado = false;
+        if (!recargando.compare_exchange_strong(esperado, true))
+            return false;
+        thread([this]() {
+            try {
+                shared_ptr<vector<Pelicula>> datos = baseDeDatos.recargar();
+                uint64_t version = ultimaVersion.load() + 1;
+                auto nueva = make_unique<InstantaneaCatalogo>(version, datos);
+                vector<pair<int64_t, int64_t>> copiados;
+                {
+                    auto anterior = publicador.leer();
+                    copiados = nueva->heredarPopularidad(*anterior);
+                }
+                // Los likes y vistas que la anterior reciba hasta quedar sin lectores se suman despues.
+                publicador.publicar(move(nueva), [&](InstantaneaCatalogo &anterior, InstantaneaCatalogo &publicada) {
+                    publicada.ponerAlDiaPopularidad(anterior, copiados);
+                });
+                ultimaVersion = version;
+                cout << "Catalogo recargado: version " << version << " (" << datos->size() << " peliculas)." << endl;
+            } catch (const exception &e) {
+                cerr << "Error al recargar el catalogo: " << e.what() << endl;
+            }
+            recargando = false;
+        }).detach();
+        return true;
+    }
+};
+
+struct SesionUsuario {
+    // Las listas guardan posiciones de 'peliculasListas', la version del catalogo en que se armaron;
+    // sincronizarListas las traslada por imdb_id cuando la sesion ve otra version.
+    ListaUsuario gustadas;
+    ListaUsuario verMasTarde;
+    shared_ptr<vector<Pelicula>> peliculasListas;
+    CuidadorHistorialBusquedas historial;
+    // Cursor de la ultima busqueda: pedir otra pagina de la misma consulta no repite la busqueda.
+    // Apunta a peliculas de una instantanea concreta, por eso se guarda su version.
+    string ultimaConsulta;
+    int ultimoModo = 0;
+    uint64_t versionCursor = 0;
+    unique_ptr<CursorResultados> cursor;
+};
+
+string escaparJSON(const string &s) {
+    string salida;
+    for (unsigned char c : s) {
+        switch (c) {
+            case '\"': salida += "\\\""; break;
+            case '\\': salida += "\\\\"; break;
+            case '\n': salida += "\\n"; break;
+            case '\r': salida += "\\r"; break;
+            case '\t': salida += "\\t"; break;
+            default:
+                if (c < 0x20) {
+                    char buffer[8];
+                    snprintf(buffer, sizeof(buffer), "\\u%04x", c);
+                    salida += buffer;
+                } else {
+                    salida.push_back(c);
+                }
+        }
+    }
+    return salida;
+}
+
+// Lee un objeto JSON plano (sin objetos ni arreglos anidados). Los valores se guardan como texto.
+bool parsearObjetoJSON(const string &linea, unordered_map<string, string> &campos) {
+    size_t i = 0;
+    auto saltarEspacios = [&]() {
+        while (i < linea.size() && isspace(static_cast<unsigned char>(linea[i])))
+            i++;
+    };
+    auto leerCadena = [&](string &salida) -> bool {
+        if (i >= linea.size() || linea[i] != '\"')
+            return false;
+        i++;
+        while (i < linea.size() && linea[i] != '\"') {
+            char c = linea[i++];
+            if (c != '\\') {
+                salida.push_back(c);
+                continue;
+            }
+            if (i >= linea.size())
+                return false;
+            char e = linea[i++];
+            if (e == 'n') salida.push_back('\n');
+            else if (e == 't') salida.push_back('\t');
+            else if (e == 'r') salida.push_back('\r');
+            else if (e == 'b') salida.push_back('\b');
+            else if (e == 'f') salida.push_back('\f');
+            else if (e == 'u') {
+                if (i + 4 > linea.size())
+                    return false;
+                unsigned int codigo = stoul(linea.substr(i, 4), nullptr, 16);
+                i += 4;
+                if (codigo < 0x80) {
+                    salida.push_back((char)codigo);
+                } else if (codigo < 0x800) {
+                    salida.push_back((char)(0xC0 | (codigo >> 6)));
+                    salida.push_back((char)(0x80 | (codigo & 0x3F)));
+                } else {
+                    salida.push_back((char)(0xE0 | (codigo >> 12)));
+                    salida.push_back((char)(0x80 | ((codigo >> 6) & 0x3F)));
+                    salida.push_back((char)(0x80 | (codigo & 0x3F)));
+                }
+            }
+            else salida.push_back(e);
+        }
+        if (i >= linea.size())
+            return false;
+        i++;
+        return true;
+    };
+    try {
+        saltarEspacios();
+        if (i >= linea.size() || linea[i] != '{')
+            return false;
+        i++;
+        saltarEspacios();
+        if (i < linea.size() && linea[i] == '}')
+            return true;
+        while (i < linea.size()) {
+            saltarEspacios();
+            string clave, valor;
+            if (!leerCadena(clave))
+                return false;
+            saltarEspacios();
+            if (i >= linea.size() || linea[i] != ':')
+                return false;
+            i++;
+            saltarEspacios();
+            if (i < linea.size() && linea[i] == '\"') {
+                if (!leerCadena(valor))
+                    return false;
+            } else {
+                while (i < linea.size() && linea[i] != ',' && linea[i] != '}' &&
+                       !isspace(static_cast<unsigned char>(linea[i]))) {
+                    if (linea[i] == '{' || linea[i] == '[')
+                        return false;
+                    valor.push_back(linea[i++]);
+                }
+                if (valor.empty())
+                    return false;
+            }
+            campos[clave] = valor;
+            saltarEspacios();
+            if (i < linea.size() && linea[i] == ',') {
+                i++;
+                continue;
+            }
+            if (i < linea.size() && linea[i] == '}')
+                return true;
+            return false;
+        }
+    } catch (...) {
+        return false;
+    }
+    return false;
+}
+
+string errorJSON(const string &mensaje) {
+    return "{\"ok\":false,\"error\":\"" + escaparJSON(mensaje) + "\"}";
+}
+
+string peliculaResumenJSON(const vector<Pelicula> &peliculas, int id) {
+    return "{\"id\":" + to_string(id) + ",\"imdb_id\":\"" + escaparJSON(peliculas[id].id) +
+           "\",\"titulo\":\"" + escaparJSON(peliculas[id].titulo) + "\"}";
+}
+
+// Arma una lista sobre la instantanea a partir de imdb_ids (omitiendo los que ya no existen).
+ListaUsuario listaDesdeImdbIds(const InstantaneaCatalogo &catalogo, const vector<string> &ids) {
+    ListaUsuario lista;
+    for (auto &id : ids)
+        lista.agregar(catalogo.buscarPorId(id));
+    return lista;
+}
+
+// Si la sesion ve otra version del catalogo (una recarga), sus listas se trasladan por imdb_id.
+void sincronizarListas(SesionUsuario &sesion, const InstantaneaCatalogo &catalogo) {
+    if (sesion.peliculasListas == catalogo.datos)
+        return;
+    if (sesion.peliculasListas) {
+        sesion.gustadas = listaDesdeImdbIds(catalogo, sesion.gustadas.imdbIds(*sesion.peliculasListas));
+        sesion.verMasTarde = listaDesdeImdbIds(catalogo, sesion.verMasTarde.imdbIds(*sesion.peliculasListas));
+    }
+    sesion.peliculasListas = catalogo.datos;
+}
+
+string listaPeliculasJSON(const vector<Pelicula> &peliculas, const vector<int> &ids) {
+    string salida = "[";
+    for (size_t i = 0; i < ids.size(); i++) {
+        if (i > 0)
+            salida += ",";
+        salida += peliculaResumenJSON(peliculas, ids[i]);
+    }
+    return salida + "]";
+}
+
+int leerEntero(const unordered_map<string, string> &campos, const string &clave, int porDefecto) {
+    auto it = campos.find(clave);
+    if (it == campos.end())
+        return porDefecto;
+    try {
+        return stoi(it->second);
+    } catch (...) {
+        return porDefecto;
+    }
+}
+
+// Pelicula de la peticion: por imdb_id, o por id solo si viene con la version vigente.
+int resolverPelicula(const unordered_map<string, string> &campos, const InstantaneaCatalogo &catalogo, string &error) {
+    auto imdb = campos.find("imdb_id");
+    if (imdb != campos.end()) {
+        int id = catalogo.buscarPorId(imdb->second);
+        if (id == -1)
+            error = "imdb_id desconocido";
+        return id;
+    }
+    int id = leerEntero(campos, "id", -1);
+    auto version = campos.find("version");
+    if (id < 0 || id >= (int)catalogo.peliculas.size())
+        error = "id de pelicula invalido";
+    else if (version == campos.end())
+        error = "falta imdb_id (o version junto con id)";
+    else if (version->second != to_string(catalogo.version))
+        error = "version desactualizada: el catalogo va por la " + to_string(catalogo.version);
+    else
+        return id;
+    return -1;
+}
+
+// Atiende una peticion de la sesion. Es una corrutina: la busqueda corre por etapas en el pool y la
+// peticion sigue en el hilo que la termine, por eso la instantanea se lee con una lectura que no
+// queda atada al hilo. La sesion (y cerrar) deben seguir vivas hasta que la tarea termine.
+Tarea<string> responderPeticion(CatalogoCompartido &compartido, SesionUsuario &sesion, string linea, bool &cerrar) {
+    unordered_map<string, string> campos;
+    if (!parsearObjetoJSON(linea, campos))
+        co_return errorJSON("JSON invalido");
+    // La instantanea leida aqui sigue viva hasta responder, aunque se publique otra mientras tanto.
+    auto lectura = compartido.publicador.leerDesacoplado();
+    InstantaneaCatalogo &catalogo = *lectura;
+    vector<Pelicula> &peliculas = catalogo.peliculas;
+    sincronizarListas(sesion, catalogo);
+    string op = campos["op"];
+    string versionJSON = "\"version\":" + to_string(catalogo.version);
+
+    if (op == "buscar") {
+        string consulta = campos["consulta"];
+        int modo = leerEntero(campos, "modo", 1) == 2 ? 2 : 1;
+        int pagina = max(0, leerEntero(campos, "pagina", 0));
+        bool mismaBusqueda = sesion.cursor && sesion.ultimaConsulta == consulta && sesion.ultimoModo == modo;
+        if (!mismaBusqueda)
+            sesion.historial.agregarMemento(MementoBusqueda(consulta, modo));
+        if (!mismaBusqueda || sesion.versionCursor != catalogo.version) {
+            // Si no esta en la cache, la busqueda corre por etapas en el pool.
+            sesion.cursor = make_unique<CursorResultados>(co_await buscarConCacheAsync(catalogo, consulta, modo));
+            sesion.ultimaConsulta = consulta;
+            sesion.ultimoModo = modo;
+            sesion.versionCursor = catalogo.version;
+        }
+        string salida = "{\"ok\":true,\"version\":" + to_string(catalogo.version) +
+                        ",\"total\":" + to_string(sesion.cursor->total()) +
+                        ",\"paginas\":" + to_string(sesion.cursor->totalPaginas()) +
+                        ",\"pagina\":" + to_string(pagina) + ",\"resultados\":[";
+        vector<pair<Pelicula*, int>> resultados = sesion.cursor->pagina(pagina);
+        for (size_t k = 0; k < resultados.size(); k++) {
+            int id = resultados[k].first - peliculas.data();
+            if (k > 0)
+                salida += ",";
+            salida += "{\"id\":" + to_string(id) + ",\"imdb_id\":\"" + escaparJSON(peliculas[id].id) +
+                      "\",\"titulo\":\"" + escaparJSON(peliculas[id].titulo) +
+                      "\",\"puntaje\":" + to_string(resultados[k].second) + "}";
+        }
+        co_return salida + "]}";
+    }
+    if (op == "autocompletar") {
+        vector<int> ids;
+        for (Pelicula* p : catalogo.autocompletado.completar(campos["prefijo"]))
+            ids.push_back(p - peliculas.data());
+        co_return "{\"ok\":true," + versionJSON + ",\"sugerencias\":" + listaPeliculasJSON(peliculas, ids) + "}";
+    }
+    if (op == "similares") {
+        string error;
+        int id = resolverPelicula(campos, catalogo, error);
+        if (id == -1)
+            co_return errorJSON(error);
+        co_return "{\"ok\":true," + versionJSON + ",\"similares\":" +
+               listaPeliculasJSON(peliculas, peliculasSimilares(catalogo.similitud, id)) + "}";
+    }
+    if (op == "pelicula" || op == "like" || op == "ver_mas_tarde") {
+        string error;
+        int id = resolverPelicula(campos, catalogo, error);
+        if (id == -1)
+            co_return errorJSON(error);
+        const Pelicula &pel = peliculas[id];
+        if (op == "like") {
+            bool gustada = sesion.gustadas.alternar(id);
+            catalogo.popularidad.sumarLike(id, gustada ? 1 : -1);
+            co_return "{\"ok\":true," + versionJSON + ",\"id\":" + to_string(id) + ",\"like\":" +
+                   (gustada ? "true" : "false") + "}";
+        }
+        if (op == "ver_mas_tarde")
+            co_return "{\"ok\":true," + versionJSON + ",\"id\":" + to_string(id) + ",\"ver_mas_tarde\":" +
+                   (sesion.verMasTarde.alternar(id) ? "true" : "false") + "}";
+        catalogo.popularidad.sumarVista(id);
+        string etiquetas = "[";
+        for (size_t i = 0; i < pel.etiquetas.size(); i++)
+            etiquetas += (i > 0 ? ",\"" : "\"") + escaparJSON(pel.etiquetas[i]) + "\"";
+        etiquetas += "]";
+        bool gustada = sesion.gustadas.contiene(id);
+        bool enLista = sesion.verMasTarde.contiene(id);
+        co_return "{\"ok\":true," + versionJSON + ",\"id\":" + to_string(id) + ",\"imdb_id\":\"" +
+               escaparJSON(pel.id) + "\",\"titulo\":\"" + escaparJSON(pel.titulo) +
+               "\",\"sinopsis\":\"" + escaparJSON(pel.sinopsis) + "\",\"etiquetas\":" + etiquetas +
+               ",\"fuente\":\"" + escaparJSON(pel.fuente) + "\",\"like\":" + (gustada ? "true" : "false") +
+               ",\"ver_mas_tarde\":" + (enLista ? "true" : "false") +
+               ",\"likes_totales\":" + to_string(catalogo.popularidad.likes(id)) +
+               ",\"vistas_totales\":" + to_string(catalogo.popularidad.vistas(id)) + "}";
+    }
+    if (op == "listas") {
+        co_return "{\"ok\":true,\"version\":" + to_string(catalogo.version) +
+               ",\"gustadas\":" + listaPeliculasJSON(peliculas, sesion.gustadas.ids()) +
+               ",\"ver_mas_tarde\":" + listaPeliculasJSON(peliculas, sesion.verMasTarde.ids()) + "}";
+    }
+    if (op == "recomendaciones") {
+        const vector<int> &gustadas = sesion.gustadas.ids();
+        vector<int> ids = recomendarPorEtiquetas(catalogo.indiceEtiquetas, peliculas, gustadas, &catalogo.popularidad);
+        completarConFactores(catalogo.factores, gustadas, ids);
+        completarConSimilares(catalogo.hnsw, gustadas, ids);
+        co_return "{\"ok\":true," + versionJSON + ",\"recomendaciones\":" + listaPeliculasJSON(peliculas, ids) + "}";
+    }
+    if (op == "historial") {
+        string salida = "{\"ok\":true,\"historial\":[";
+        const vector<MementoBusqueda> &historial = sesion.historial.obtenerHistorial();
+        for (size_t i = 0; i < historial.size(); i++) {
+            if (i > 0)
+                salida += ",";
+            salida += "{\"consulta\":\"" + escaparJSON(historial[i].consulta) + "\",\"modo\":" +
+                      to_string(historial[i].modoBusqueda) + "}";
+        }
+        co_return salida + "]}";
+    }
+    if (op == "borrar_historial") {
+        sesion.historial.borrarHistorial();
+        co_return "{\"ok\":true}";
+    }
+    if (op == "version")
+        co_return "{\"ok\":true,\"version\":" + to_string(catalogo.version) +
+               ",\"peliculas\":" + to_string(peliculas.size()) + "}";
+    if (op == "cache") {
+        CacheConsultas::Estadisticas e = cacheConsultas.estadisticas();
+        co_return "{\"ok\":true,\"aciertos\":" + to_string(e.aciertos) + ",\"fallos\":" + to_string(e.fallos) +
+               ",\"invalidaciones\":" + to_string(e.invalidaciones) + ",\"entradas\":" + to_string(e.entradas) +
+               ",\"bytes\":" + to_string(e.bytes) + ",\"capacidad_bytes\":" + to_string(e.capacidadBytes) + "}";
+    }
+    if (op == "recargar")
+        co_return string("{\"ok\":true,\"recargando\":") + (compartido.recargarEnSegundoPlano() ? "true" : "false") + "}";
+    if (op == "salir") {
+        cerrar = true;
+        co_return "{\"ok\":true}";
+    }
+    co_return errorJSON("operacion desconocida: " + op);
+}
+
+#ifndef _WIN32
+// Una conexion del servidor. Sus peticiones se atienden de a una y en orden: mientras una corre en
+// el pool, las lineas siguientes esperan en 'lineas'.
+struct Conexion {
+    int descriptor;
+    SesionUsuario sesion;
+    string entrada;          // Lo recibido despues del ultimo fin de linea
+    deque<string> lineas;    // Peticiones completas sin atender
+    string salida;           // Respuestas por enviar
+    bool enCurso = false;
+    bool cerrar = false;     // Se cierra despues de enviar la salida
+    bool desconectada = false;
+    explicit Conexion(int descriptor) : descriptor(descriptor) {}
+};
+
+// Un solo hilo atiende todos los sockets con poll(). Cada peticion es una corrutina sobre el pool
+// que, al terminar, deja su respuesta en 'terminadas' y despierta al bucle escribiendo en un pipe;
+// asi ningun hilo queda bloqueado por una sesion.
+class BucleServidor {
+private:
+    static const size_t LARGO_MAXIMO_LINEA = 1 << 20;
+    static const size_t MAXIMO_LINEAS_PENDIENTES = 64;
+    CatalogoCompartido &catalogo;
+    int servidor;
+    int aviso[2];
+    mutex mTerminadas;
+    vector<pair<Conexion*, string>> terminadas;
+    unordered_map<int, unique_ptr<Conexion>> conexiones;
+
+    static TareaDesacoplada atender(BucleServidor &bucle, Conexion &conexion, string linea) {
+        co_await cambiarAlPool();
+        string respuesta;
+        try {
+            respuesta = co_await responderPeticion(bucle.catalogo, conexion.sesion, move(linea), conexion.cerrar);
+        } catch (const exception &e) {
+            respuesta = errorJSON(string("error interno: ") + e.what());
+        }
+        {
+            lock_guard<mutex> lk(bucle.mTerminadas);
+            bucle.terminadas.push_back(make_pair(&conexion, move(respuesta)));
+        }
+        char byte = 0;
+        while (write(bucle.aviso[1], &byte, 1) < 0 && errno == EINTR) {}
+    }
+
+    static bool quiereLeer(const Conexion &c) {
+        return !c.cerrar && !c.desconectada && c.entrada.size() <= LARGO_MAXIMO_LINEA &&
+               c.lineas.size() < MAXIMO_LINEAS_PENDIENTES;
+    }
+
+    void recibir(Conexion &c) {
+        char buffer[4096];
+        while (quiereLeer(c)) {
+            ssize_t n = recv(c.descriptor, buffer, sizeof(buffer), 0);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                return;
+            if (n <= 0) {
+                c.desconectada = true;
+                return;
+            }
+            c.entrada.append(buffer, n);
+            size_t finLinea;
+            while ((finLinea = c.entrada.find('\n')) != string::npos) {
+                string linea = c.entrada.substr(0, finLinea);
+                c.entrada.erase(0, finLinea + 1);
+                if (!linea.empty() && linea.back() == '\r')
+                    linea.pop_back();
+                if (!normalizarEspacios(linea).empty())
+                    c.lineas.push_back(move(linea));
+            }
+        }
+    }
+
+    void enviar(Conexion &c) {
+        while (!c.salida.empty()) {
+            ssize_t n = send(c.descriptor, c.salida.data(), c.salida.size(), 0);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                return;
+            if (n <= 0) {
+                c.desconectada = true;
+                c.salida.clear();
+                return;
+            }
+            c.salida.erase(0, n);
+        }
+    }
+
+    void recogerTerminadas() {
+        char bytes[256];
+        while (read(aviso[0], bytes, sizeof(bytes)) > 0) {}
+        vector<pair<Conexion*, string>> listas;
+        {
+            lock_guard<mutex> lk(mTerminadas);
+            listas.swap(terminadas);
+        }
+        for (auto &[conexion, respuesta] : listas) {
+            if (!conexion->desconectada)
+                conexion->salida += respuesta + "\n";
+            conexion->enCurso = false;
+        }
+    }
+
+    // Lanza la siguiente peticion de cada conexion libre y cierra las que ya terminaron.
+    void despachar() {
+        for (auto it = conexiones.begin(); it != conexiones.end();) {
+            Conexion &c = *it->second;
+            if (!c.enCurso && !c.cerrar && !c.desconectada) {
+                if (!c.lineas.empty()) {
+                    string linea = move(c.lineas.front());
+                    c.lineas.pop_front();
+                    c.enCurso = true;
+                    atender(*this, c, move(linea));
+                } else if (c.entrada.size() > LARGO_MAXIMO_LINEA) {
+                    c.salida += errorJSON("linea demasiado larga") + "\n";
+                    c.cerrar = true;
+                }
+            }
+            if (!c.desconectada)
+                enviar(c);
+            if (!c.enCurso && (c.desconectada || (c.cerrar && c.salida.empty()))) {
+                close(c.descriptor);
+                it = conexiones.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+public:
+    BucleServidor(CatalogoCompartido &catalogo, int servidor) : catalogo(catalogo), servidor(servidor) {
+        if (pipe(aviso) < 0)
+            throw runtime_error("no se pudo crear el pipe del servidor");
+        for (int d : {aviso[0], aviso[1], servidor})
+            fcntl(d, F_SETFL, fcntl(d, F_GETFL) | O_NONBLOCK);
+    }
+    ~BucleServidor() {
+        close(aviso[0]);
+        close(aviso[1]);
+    }
+
+    // Corre hasta que deja de poder aceptar conexiones y se cierran las que quedaban.
+    int ejecutar() {
+        bool escuchando = true;
+        while (escuchando || !conexiones.empty()) {
+            vector<pollfd> fds;
+            vector<Conexion*> porIndice;
+            fds.push_back({aviso[0], POLLIN, 0});
+            fds.push_back({escuchando ? servidor : -1, POLLIN, 0});
+            for (auto &[descriptor, conexion] : conexiones) {
+                short eventos = 0;
+                if (quiereLeer(*conexion))
+                    eventos |= POLLIN;
+                if (!conexion->salida.empty() && !conexion->desconectada)
+                    eventos |= POLLOUT;
+                fds.push_back({descriptor, eventos, 0});
+                porIndice.push_back(conexion.get());
+            }
+            if (poll(fds.data(), fds.size(), -1) < 0) {
+                if (errno == EINTR)
+                    continue;
+                cerr << "Error en poll()." << endl;
+                return 1;
+            }
+            if (fds[0].revents & POLLIN)
+                recogerTerminadas();
+            if (fds[1].revents & POLLIN) {
+                while (true) {
+                    int cliente = accept(servidor, nullptr, nullptr);
+                    if (cliente < 0) {
+                        if (errno == EINTR || errno == ECONNABORTED)
+                            continue;
+                        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                            cerr << "Error al aceptar una conexion." << endl;
+                            escuchando = false;
+                        }
+                        break;
+                    }
+                    fcntl(cliente, F_SETFL, fcntl(cliente, F_GETFL) | O_NONBLOCK);
+                    conexiones[cliente] = make_unique<Conexion>(cliente);
+                }
+            }
+            for (size_t k = 0; k < porIndice.size(); k++) {
+                short eventos = fds[k + 2].revents;
+                if (eventos & POLLIN)
+                    recibir(*porIndice[k]);
+                else if (eventos & (POLLHUP | POLLERR | POLLNVAL))
+                    porIndice[k]->desconectada = true;
+                if (eventos & POLLOUT)
+                    enviar(*porIndice[k]);
+            }
+            despachar();
+        }
+        return 0;
+    }
+};
+
+int ejecutarServidor(const string &direccion, CatalogoCompartido &catalogo) {
+    signal(SIGPIPE, SIG_IGN);
+    bool esTCP = !direccion.empty() && all_of(direccion.begin(), direccion.end(), ::isdigit);
+    int servidor;
+    if (esTCP) {
+        char* fin = nullptr;
+        errno = 0;
+        long puerto = strtol(direccion.c_str(), &fin, 10);
+        if (errno != 0 || *fin != '\0' || puerto < 1 || puerto > 65535) {
+            cerr << "Puerto invalido: " << direccion << " (debe estar entre 1 y 65535)." << endl;
+            return 1;
+        }
+        servidor = socket(AF_INET, SOCK_STREAM, 0);
+        int activar = 1;
+        setsockopt(servidor, SOL_SOCKET, SO_REUSEADDR, &activar, sizeof(activar));
+        sockaddr_in dir{};
+        dir.sin_family = AF_INET;
+        dir.sin_port = htons((uint16_t)puerto);
+        dir.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (servidor < 0 || ::bind(servidor, (sockaddr*)&dir, sizeof(dir)) < 0) {
+            cerr << "No se pudo abrir el puerto " << direccion << "." << endl;
+            return 1;
+        }
+    } else {
+        servidor = socket(AF_UNIX, SOCK_STREAM, 0);
+        sockaddr_un dir{};
+        dir.sun_family = AF_UNIX;
+        strncpy(dir.sun_path, direccion.c_str(), sizeof(dir.sun_path) - 1);
+        unlink(direccion.c_str());
+        if (servidor < 0 || ::bind(servidor, (sockaddr*)&dir, sizeof(dir)) < 0) {
+            cerr << "No se pudo crear el socket " << direccion << "." << endl;
+            return 1;
+        }
+    }
+    if (listen(servidor, 64) < 0) {
+        cerr << "No se pudo escuchar en " << direccion << "." << endl;
+        return 1;
+    }
+    cout << "Servidor escuchando en " << (esTCP ? "127.0.0.1:" : "") << direccion << endl;
+    int codigo = BucleServidor(catalogo, servidor).ejecutar();
+    close(servidor);
+    return codigo;
+}
+#else
+int ejecutarServidor([[maybe_unused]] const string &direccion, [[maybe_unused]] CatalogoCompartido &catalogo) {
+    cerr << "El modo servidor necesita sockets POSIX (Linux o macOS)." << endl;
+    return 1;
+}
+#endif
+
+// -------------------- MODO LOTE (CONSULTAS NO INTERACTIVAS) --------------------
+// Se ejecuta con --lote <archivo> (o --lote - para leer de la entrada estandar): una consulta por
+// linea, todas en el modo indicado con --modo. Las consultas se normalizan (minusculas y espacios
+// simples) y las repetidas se ejecutan una sola vez; las distintas se reparten en el pool. Por cada
+// linea no vacia se escribe, en el mismo orden, una linea JSON con las --top mejores peliculas:
+//   {"consulta":"star war","modo":1,"total":12,"resultados":[{"id":3,"imdb_id":"tt...","titulo":"...","puntaje":53}]}
+// Al terminar se informa el rendimiento (consultas por segundo) por la salida de errores.
+
+MemoriaLote prepararMemoriaLote(const InstantaneaCatalogo &catalogo, const vector<string> &consultas, int modo) {
+    MemoriaLote memoria;
+    PoolHilos &pool = PoolHilos::global();
+    if (modo == 1) {
+        const vector<Pelicula> &peliculas = catalogo.peliculas;
+        memoria.titulos.resize(peliculas.size());
+        memoria.titulosNorm.resize(peliculas.size());
+        memoria.sinopsis.resize(peliculas.size());
+        pool.paraCadaBloque(peliculas.size(), pool.tamano(), [&](size_t inicio, size_t fin, size_t) {
+            for (size_t i = inicio; i < fin; i++) {
+                memoria.titulos[i] = aMinusculas(peliculas[i].titulo);
+                memoria.titulosNorm[i] = normalizarEspacios(memoria.titulos[i]);
+                memoria.sinopsis[i] = aMinusculas(peliculas[i].sinopsis);
+            }
+        });
+    } else {
+        vector<string> fragmentos;
+        for (const string &consulta : consultas)
+            for (string &fragmento : EstrategiaEtiqueta::separarEtiquetasConsulta(consulta))
+                if (memoria.etiquetasPorFragmento.emplace(fragmento, vector<int>()).second)
+                    fragmentos.push_back(fragmento);
+        // El mapa ya tiene todas sus claves: cada bloque solo escribe en los valores de sus fragmentos.
+        pool.paraCadaBloque(fragmentos.size(), pool.tamano(), [&](size_t inicio, size_t fin, size_t) {
+            for (size_t i = inicio; i < fin; i++)
+                memoria.etiquetasPorFragmento.find(fragmentos[i])->second =
+                    catalogo.indiceEtiquetas.etiquetasQueContienen(fragmentos[i]);
+        });
+    }
+    return memoria;
+}
+
+int ejecutarLote(InstantaneaCatalogo &catalogo, const string &archivo, int modo, size_t top) {
+    ifstream archivoEntrada;
+    if (archivo != "-") {
+        archivoEntrada.open(archivo);
+        if (!archivoEntrada) {
+            cerr << "No se pudo abrir el archivo de consultas " << archivo << "." << endl;
+            return 1;
+        }
+    }
+    istream &entrada = (archivo == "-") ? cin : archivoEntrada;
+    vector<string> lineas;
+    string linea;
+    while (getline(entrada, linea)) {
+        if (!linea.empty() && linea.back() == '\r')
+            linea.pop_back();
+        lineas.push_back(linea);
+    }
+
+    auto inicio = chrono::steady_clock::now();
+    // Normalizacion y deduplicacion: cada linea apunta a su consulta distinta (-1 si esta vacia).
+    vector<int> consultaDeLinea(lineas.size(), -1);
+    vector<string> distintas;
+    unordered_map<string, int> posicion;
+    for (size_t i = 0; i < lineas.size(); i++) {
+        string normalizada = normalizarEspacios(aMinusculas(lineas[i]));
+        if (normalizada.empty())
+            continue;
+        auto [it, nueva] = posicion.emplace(normalizada, (int)distintas.size());
+        if (nueva)
+            distintas.push_back(normalizada);
+        consultaDeLinea[i] = it->second;
+    }
+    MemoriaLote memoria = prepararMemoriaLote(catalogo, distintas, modo);
+
+    // Cada consulta distinta deja su respuesta (sin la consulta original) en su propia casilla.
+    vector<Pelicula> &peliculas = catalogo.peliculas;
+    vector<string> respuestas(distintas.size());
+    PoolHilos &pool = PoolHilos::global();
+    pool.paraCadaBloque(distintas.size(), pool.tamano() * 4, [&](size_t desde, size_t hasta, size_t) {
+        for (size_t q = desde; q < hasta; q++) {
+            CursorResultados cursor(ejecutarBusqueda(catalogo, distintas[q], modo, &memoria));
+            cursor.asegurarOrdenados(top);
+            string salida = "\"total\":" + to_string(cursor.total()) + ",\"resultados\":[";
+            for (size_t k = 0; k < top && k < cursor.total(); k++) {
+                const pair<Pelicula*, int> &resultado = cursor.obtener(k);
+                int id = resultado.first - peliculas.data();
+                if (k > 0)
+                    salida += ",";
+                salida += "{\"id\":" + to_string(id) + ",\"imdb_id\":\"" + escaparJSON(peliculas[id].id) +
+                          "\",\"titulo\":\"" + escaparJSON(peliculas[id].titulo) +
+                          "\",\"puntaje\":" + to_string(resultado.second) + "}";
+            }
+            respuestas[q] = salida + "]";
+        }
+    });
+
+    string salida;
+    size_t escritas = 0;
+    for (size_t i = 0; i < lineas.size(); i++) {
+        if (consultaDeLinea[i] == -1)
+            continue;
+        salida += "{\"consulta\":\"" + escaparJSON(lineas[i]) + "\",\"modo\":" + to_string(modo) + "," +
+                  respuestas[consultaDeLinea[i]] + "}\n";
+        escritas++;
+    }
+    cout << salida << flush;
+    chrono::duration<double> tiempo = chrono::steady_clock::now() - inicio;
+    cerr << "Lote: " << escritas << " consultas (" << distintas.size() << " distintas) en " << tiempo.count()
+         << " s -> " << (tiempo.count() > 0 ? escritas / tiempo.count() : 0.0) << " consultas/s." << endl;
+    return 0;
+}
+
+// Trabajo por lotes de casi duplicados: una linea JSON por grupo con sus peliculas (de fuentes
+// distintas o repetidas) y un resumen por la salida de errores.
+int ejecutarDuplicados(const InstantaneaCatalogo &catalogo, float umbral) {
+    auto inicio = chrono::steady_clock::now();
+    vector<vector<int>> grupos = agruparCasiDuplicados(catalogo.minhash, umbral);
+    const vector<Pelicula> &peliculas = catalogo.peliculas;
+    string salida;
+    size_t repetidas = 0;
+    for (size_t g = 0; g < grupos.size(); g++) {
+        salida += "{\"grupo\":" + to_string(g + 1) + ",\"peliculas\":[";
+        for (size_t k = 0; k < grupos[g].size(); k++) {
+            const Pelicula &pel = peliculas[grupos[g][k]];
+            if (k > 0)
+                salida += ",";
+            salida += "{\"id\":" + to_string(grupos[g][k]) + ",\"imdb_id\":\"" + escaparJSON(pel.id) +
+                      "\",\"titulo\":\"" + escaparJSON(pel.titulo) + "\",\"fuente\":\"" + escaparJSON(pel.fuente) +
+                      "\",\"jaccard\":" + to_string(jaccardEstimado(catalogo.minhash, grupos[g][0], grupos[g][k])) + "}";
+        }
+        salida += "]}\n";
+        repetidas += grupos[g].size() - 1;
+    }
+    cout << salida << flush;
+    chrono::duration<double> tiempo = chrono::steady_clock::now() - inicio;
+    cerr << "Duplicados: " << grupos.size() << " grupos, " << repetidas << " peliculas sobrantes (umbral "
+         << umbral << ") en " << tiempo.count() << " s." << endl;
+    return 0;
+}
+
+// Reporte de memoria: una fila por estructura de la instantanea con sus bytes, elementos y
+// bytes por pelicula, y el total al final.
+int ejecutarReporteMemoria(const InstantaneaCatalogo &catalogo) {
+    ReporteMemoria reporte = catalogo.memoria();
+    size_t n = max<size_t>(1, catalogo.peliculas.size());
+    size_t total = 0;
+    char linea[160];
+    snprintf(linea, sizeof(linea), "%-34s %14s %12s %12s\n", "Estructura", "Bytes", "Elementos", "Bytes/pel.");
+    string salida = linea;
+    for (const FilaMemoria &fila : reporte) {
+        snprintf(linea, sizeof(linea), "%-34s %14zu %12zu %12.1f\n", fila.estructura.c_str(), fila.bytes,
+                 fila.elementos, (double)fila.bytes / n);
+        salida += linea;
+        total += fila.bytes;
+    }
+    snprintf(linea, sizeof(linea), "%-34s %14zu %12zu %12.1f\n", "TOTAL", total, catalogo.peliculas.size(),
+             (double)total / n);
+    cout << salida << linea << flush;
+    return 0;
+}
+
+// Recomendaciones por lotes. Cada linea es "usuario,imdb_id,imdb_id,..." (comas o espacios) y por
+// cada una se escribe, en el mismo orden, una linea JSON con su top-k. Las lineas se procesan por
+// rondas de USUARIOS_POR_RONDA: en cada ronda los usuarios con el mismo conjunto de etiquetas
+// gustadas comparten un solo recorrido de las listas del indice (se piden k + gustadas
+// candidatas y cada usuario filtra las suyas), los conjuntos distintos y los usuarios se
+// reparten en el pool, y la ronda se escribe antes de leer la siguiente.
+int ejecutarRecomendacionesLote(const InstantaneaCatalogo &catalogo, const string &archivo, size_t top) {
+    const size_t USUARIOS_POR_RONDA = 16384;
+    ifstream archivoEntrada;
+    if (archivo != "-") {
+        archivoEntrada.open(archivo);
+        if (!archivoEntrada) {
+            cerr << "No se pudo abrir el archivo de usuarios " << archivo << "." << endl;
+            return 1;
+        }
+    }
+    istream &entrada = (archivo == "-") ? cin : archivoEntrada;
+    const vector<Pelicula> &peliculas = catalogo.peliculas;
+    PoolHilos &pool = PoolHilos::global();
+    auto inicio = chrono::steady_clock::now();
+    size_t escritos = 0, conjuntosTotales = 0;
+    vector<string> lineas;
+    string linea;
+    bool quedan = true;
+    while (quedan) {
+        lineas.clear();
+        while (lineas.size() < USUARIOS_POR_RONDA && (quedan = (bool)getline(entrada, linea))) {
+            if (!linea.empty() && linea.back() == '\r')
+                linea.pop_back();
+            if (!recortar(linea).empty())
+                lineas.push_back(linea);
+        }
+        size_t n = lineas.size();
+        if (n == 0)
+            break;
+        // 1. Usuario, gustadas y conjunto de etiquetas de cada linea.
+        vector<string> usuarios(n);
+        vector<vector<int>> gustadas(n), etiquetas(n);
+        pool.paraCadaBloque(n, pool.tamano() * 4, [&](size_t desde, size_t hasta, size_t) {
+            for (size_t i = desde; i < hasta; i++) {
+                string campos = lineas[i];
+                replace(campos.begin(), campos.end(), ',', ' ');
+                stringstream ss(campos);
+                string id;
+                ss >> usuarios[i];
+                while (ss >> id) {
+                    int pelicula = catalogo.buscarPorId(id);
+                    if (pelicula != -1)
+                        gustadas[i].push_back(pelicula);
+                }
+                sort(gustadas[i].begin(), gustadas[i].end());
+                gustadas[i].erase(unique(gustadas[i].begin(), gustadas[i].end()), gustadas[i].end());
+                etiquetas[i] = etiquetasDeGustadas(catalogo.indiceEtiquetas, peliculas, gustadas[i]);
+            }
+        });
+        // 2. Conjuntos de etiquetas distintos y cuantas candidatas necesita cada uno.
+        vector<int> conjuntoDe(n);
+        vector<const vector<int>*> conjuntos;
+        vector<size_t> pedir;
+        map<vector<int>, int> posicion;
+        for (size_t i = 0; i < n; i++) {
+            auto [it, nuevo] = posicion.emplace(etiquetas[i], (int)conjuntos.size());
+            if (nuevo) {
+                conjuntos.push_back(&it->first);
+                pedir.push_back(0);
+            }
+            conjuntoDe[i] = it->second;
+            pedir[it->second] = max(pedir[it->second], top + gustadas[i].size());
+        }
+        conjuntosTotales += conjuntos.size();
+        vector<vector<int>> candidatas(conjuntos.size());
+        pool.paraCadaBloque(conjuntos.size(), pool.tamano() * 4, [&](size_t desde, size_t hasta, size_t) {
+            for (size_t c = desde; c < hasta; c++)
+                candidatas[c] = recomendarPorConjuntoEtiquetas(catalogo.indiceEtiquetas, *conjuntos[c], {},
+                                                               &catalogo.popularidad, pedir[c]);
+        });
+        // 3. Filtrado y relleno por usuario, y una linea JSON por usuario.
+        vector<string> respuestas(n);
+        pool.paraCadaBloque(n, pool.tamano() * 4, [&](size_t desde, size_t hasta, size_t) {
+            for (size_t i = desde; i < hasta; i++) {
+                vector<int> ids;
+                for (int pelicula : candidatas[conjuntoDe[i]]) {
+                    if (ids.size() >= top)
+                        break;
+                    if (!binary_search(gustadas[i].begin(), gustadas[i].end(), pelicula))
+                        ids.push_back(pelicula);
+                }
+                completarConFactores(catalogo.factores, gustadas[i], ids, top);
+                completarConSimilares(catalogo.hnsw, gustadas[i], ids, top);
+                string &salida = respuestas[i];
+                salida = "{\"usuario\":\"" + escaparJSON(usuarios[i]) + "\",\"gustadas\":" +
+                         to_string(gustadas[i].size()) + ",\"recomendaciones\":[";
+                for (size_t r = 0; r < ids.size(); r++) {
+                    if (r > 0)
+                        salida += ",";
+                    salida += "{\"id\":" + to_string(ids[r]) + ",\"imdb_id\":\"" + escaparJSON(peliculas[ids[r]].id) +
+                              "\",\"titulo\":\"" + escaparJSON(peliculas[ids[r]].titulo) + "\"}";
+                }
+                salida += "]}\n";
+            }
+        });
+        for (string &respuesta : respuestas)
+            cout << respuesta;
+        cout << flush;
+        escritos += n;
+    }
+    chrono::duration<double> tiempo = chrono::steady_clock::now() - inicio;
+    cerr << "Recomendaciones: " << escritos << " usuarios (" << conjuntosTotales << " conjuntos de etiquetas distintos) en "
+         << tiempo.count() << " s -> " << (tiempo.count() > 0 ? escritos / tiempo.count() : 0.0) << " usuarios/s." << endl;
+    return 0;
+}
+
 // -------------------- MENU PRINCIPAL --------------------
-int main() {
-    cout << "========================================" << endl;
-    cout << " BIENVENIDO A LA PLATAFORMA DE STREAMING" << endl;
-    cout << "========================================" << endl;
+// Los benchmarks (bench/benchmark.cpp) incluyen este archivo con PROGRAIII_SIN_MAIN definido
+// para usar las funciones sin el programa.
+#ifndef PROGRAIII_SIN_MAIN
+void mostrarUso(const char* programa) {
+    cerr << "Uso: " << programa << " [--servidor <puerto|ruta_socket>]" << endl;
+    cerr << "     " << programa << " --lote <archivo|-> [--modo 1|2] [--top N]" << endl;
+    cerr << "     " << programa << " --recomendar-lote <archivo|-> [--top N]" << endl;
+    cerr << "     " << programa << " --duplicados [--umbral 0..1]" << endl;
+    cerr << "     " << programa << " --mem-report" << endl;
+    cerr << "     " << programa << " --entrenar-cf <eventos> <modelo> [--dimension 1..1024] [--iteraciones N]" << endl;
+    cerr << "     (cualquier modo) --hnsw <archivo>: lee o guarda el grafo HNSW de similitud" << endl;
+    cerr << "     (cualquier modo) --factores <modelo>: usa los factores de filtrado colaborativo" << endl;
+}
+
+// Lee un entero de la linea de comandos; false si no es un numero completo en [minimo, maximo].
+bool leerArgumento(const char* texto, long minimo, long maximo, int &valor) {
+    char* fin = nullptr;
+    errno = 0;
+    long leido = strtol(texto, &fin, 10);
+    if (errno != 0 || fin == texto || *fin != '\0' || leido < minimo || leido > maximo)
+        return false;
+    valor = (int)leido;
+    return true;
+}
+
+bool leerArgumento(const char* texto, float minimo, float maximo, float &valor) {
+    char* fin = nullptr;
+    errno = 0;
+    float leido = strtof(texto, &fin);
+    if (errno != 0 || fin == texto || *fin != '\0' || !(leido >= minimo && leido <= maximo))
+        return false;
+    valor = leido;
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    string direccionServidor;
+    string archivoLote;
+    int modoLote = 1;
+    int topLote = 0;   // 0: el valor por defecto del modo
+    bool duplicados = false;
+    bool reporteMemoria = false;
+    string archivoUsuarios;
+    string archivoEventosCF, archivoModeloCF;
+    int dimensionCF = DIMENSION_CF;
+    int iteracionesCF = ITERACIONES_CF;
+    float umbralDuplicados = UMBRAL_CASI_DUPLICADO;
+    bool conModo = false, conTop = false, conUmbral = false, conOpcionesCF = false;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        bool valido = true;
+        if (arg == "--servidor" && i + 1 < argc) {
+            direccionServidor = argv[++i];
+        } else if (arg == "--lote" && i + 1 < argc) {
+            archivoLote = argv[++i];
+        } else if (arg == "--modo" && i + 1 < argc) {
+            valido = leerArgumento(argv[++i], 1, 2, modoLote);
+            conModo = true;
+        } else if (arg == "--top" && i + 1 < argc) {
+            valido = leerArgumento(argv[++i], 1, numeric_limits<int>::max(), topLote);
+            conTop = true;
+        } else if (arg == "--recomendar-lote" && i + 1 < argc) {
+            archivoUsuarios = argv[++i];
+        } else if (arg == "--duplicados") {
+            duplicados = true;
+        } else if (arg == "--mem-report") {
+            reporteMemoria = true;
+        } else if (arg == "--umbral" && i + 1 < argc) {
+            valido = leerArgumento(argv[++i], 0.0f, 1.0f, umbralDuplicados);
+            conUmbral = true;
+        } else if (arg == "--entrenar-cf" && i + 2 < argc) {
+            archivoEventosCF = argv[++i];
+            archivoModeloCF = argv[++i];
+        } else if (arg == "--dimension" && i + 1 < argc) {
+            valido = leerArgumento(argv[++i], 1, 1024, dimensionCF);
+            conOpcionesCF = true;
+        } else if (arg == "--iteraciones" && i + 1 < argc) {
+            valido = leerArgumento(argv[++i], 1, numeric_limits<int>::max(), iteracionesCF);
+            conOpcionesCF = true;
+        } else if (arg == "--factores" && i + 1 < argc) {
+            archivoFactoresCF = argv[++i];
+        } else if (arg == "--hnsw" && i + 1 < argc) {
+            archivoIndiceHNSW = argv[++i];
+        } else {
+            valido = false;
+        }
+        if (!valido) {
+            if (i < argc && arg != argv[i])
+                cerr << "Valor invalido para " << arg << ": " << argv[i] << endl;
+            mostrarUso(argv[0]);
+            return 1;
+        }
+    }
+    // Las opciones de un modo no se aceptan sin ese modo (se ignorarian sin avisar).
+    bool sinModo = (conModo && archivoLote.empty()) ||
+                   (conTop && archivoLote.empty() && archivoUsuarios.empty()) ||
+                   (conUmbral && !duplicados) || (conOpcionesCF && archivoEventosCF.empty());
+    if (sinModo) {
+        cerr << "--modo, --top, --umbral, --dimension e --iteraciones solo valen junto con su modo." << endl;
+        mostrarUso(argv[0]);
+        return 1;
+    }
+
+    // El entrenamiento no necesita el catalogo.
+    if (!archivoEventosCF.empty())
+        return ejecutarEntrenamientoCF(archivoEventosCF, archivoModeloCF, dimensionCF, iteracionesCF);
+
+    // En los modos por lotes la salida estandar queda solo para las lineas JSON.
+    bool porLotes = !archivoLote.empty() || !archivoUsuarios.empty() || duplicados || reporteMemoria;
+    ostream &info = porLotes ? cerr : cout;
+    if (!porLotes) {
+        cout << "========================================" << endl;
+        cout << " BIENVENIDO A LA PLATAFORMA DE STREAMING" << endl;
+        cout << "========================================" << endl;
+    }
 
     // Cargar base de datos (Singleton Template)
     BaseDeDatos<Pelicula>* bd = BaseDeDatos<Pelicula>::obtenerInstancia("mpst_full_data.csv", cargarPeliculas);
     vector<Pelicula>& peliculas = bd->obtenerDatos();
 
-    cout << "\nTotal de peliculas cargadas: " << peliculas.size() << endl;
+    info << "\nTotal de peliculas cargadas: " << peliculas.size() << endl;
+
+    // Catalogo + indices como instantanea versionada (ver InstantaneaCatalogo)
+    PublicadorRCU<InstantaneaCatalogo> publicador;
+    publicador.publicar(make_unique<InstantaneaCatalogo>(1, bd->compartirDatos()));
 
-    auto indiceModo1 = construirIndice(peliculas);
-    auto indiceEtiqueta = construirIndiceEtiquetas(peliculas);
+    if (!direccionServidor.empty()) {
+        CatalogoCompartido catalogo(publicador, *bd);
+        return ejecutarServidor(direccionServidor, catalogo);
+    }
+    if (!archivoLote.empty()) {
+        auto lectura = publicador.leer();
+        return ejecutarLote(*lectura, archivoLote, modoLote, topLote > 0 ? topLote : 10);
+    }
+    if (!archivoUsuarios.empty()) {
+        auto lectura = publicador.leer();
+        return ejecutarRecomendacionesLote(*lectura, archivoUsuarios,
+                                           topLote > 0 ? topLote : RECOMENDACIONES_POR_USUARIO);
+    }
+    if (duplicados) {
+        auto lectura = publicador.leer();
+        return ejecutarDuplicados(*lectura, umbralDuplicados);
+    }
+    if (reporteMemoria) {
+        auto lectura = publicador.leer();
+        return ejecutarReporteMemoria(*lectura);
+    }
 
-    vector<Pelicula*> gustadas;
-    vector<Pelicula*> verMasTarde;
-    vector<Pelicula*> recomendadas = recomendarPeliculas(peliculas, gustadas);
+    // El modo interactivo no recarga: mantiene la misma instantanea durante toda la sesion.
+    auto lectura = publicador.leer();
+    InstantaneaCatalogo &catalogo = *lectura;
+    catalogoInteractivo = &catalogo;
 
-    // Crear observador de recomendaciones (Observer)
-    ObservadorRecomendacion obsRecomendacion(gustadas, recomendadas, peliculas);
+    ListaUsuario gustadas;
+    ListaUsuario verMasTarde;
+    vector<Pelicula*> recomendadas;
 
-    // Construir el texto global y mapeo de posiciones
-    string textoGlobal = "";
-    vector<int> mapeoPos;
-    for (int i = 0; i < peliculas.size(); i++) {
-        string textoPelicula = aMinusculas(peliculas[i].titulo) + " " + aMinusculas(peliculas[i].sinopsis) + "#";
-        textoGlobal += textoPelicula;
-        for (int j = 0; j < textoPelicula.size(); j++) {
-            mapeoPos.push_back(i);
-        }
-    }
-    // Construir el arbol de sufijos usando Ukkonen
-    arbolSufijosGlobal = new ArbolSufijosUkkonen(textoGlobal, mapeoPos);
+    // Crear observador de recomendaciones (Observer): recibe cada like y unlike del submenu
+    ObservadorRecomendacion obsRecomendacion(gustadas, recomendadas, peliculas, catalogo.indiceEtiquetas,
+                                             &catalogo.popularidad, &catalogo.hnsw, &catalogo.factores);
+    sujetoGustadas.suscribir(&obsRecomendacion);
 
     cout << "\n=== Inicio ===" << endl;
-    if (verMasTarde.empty())
+    if (verMasTarde.vacia())
         cout << "\nNo hay peliculas en 'Ver mas tarde'." << endl;
     else {
         cout << "\nPeliculas en 'Ver mas tarde':" << endl;
-        mostrarListaTitulos(verMasTarde);
+        mostrarListaTitulos(verMasTarde.punteros(peliculas));
     }
     if (recomendadas.empty())
         cout << "\nNo hay recomendaciones (aun no has dado Like a ninguna pelicula)." << endl;
@@ -1018,27 +5530,27 @@ int main() {
             }
         }
         if (op == 6) {
+            cout << "\n" << resumenCacheConsultas() << endl;
             cout << "\nSaliendo del programa. Gracias por utilizar la Plataforma de Streaming." << endl;
             break;
         }
         else if (op == 1) {
-            manejarBusqueda(peliculas, indiceModo1, indiceEtiqueta, gustadas, verMasTarde);
+            manejarBusqueda(catalogo, gustadas, verMasTarde);
         }
         else if (op == 2) {
             manejarLista(recomendadas, "Recomendaciones", gustadas, verMasTarde);
         }
         else if (op == 3) {
-            manejarLista(verMasTarde, "Ver mas tarde", gustadas, verMasTarde);
+            manejarLista(verMasTarde.punteros(peliculas), "Ver mas tarde", gustadas, verMasTarde);
         }
         else if (op == 4) {
-            manejarLista(gustadas, "Peliculas a las que di Like", gustadas, verMasTarde);
+            manejarLista(gustadas.punteros(peliculas), "Peliculas a las que di Like", gustadas, verMasTarde);
         }
         else if (op == 5) {
             manejarHistorialBusquedas();
         }
-        // Notificar al observador para actualizar recomendaciones
-        obsRecomendacion.actualizar();
     }
     cout << "\nPrograma finalizado." << endl;
     return 0;
 }
+#endif
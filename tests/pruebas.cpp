@@ -0,0 +1,205 @@
+// -------------------- PRUEBAS --------------------
+// Pruebas de las piezas con invariantes faciles de comprobar: el codec y el indice de posiciones,
+// las listas del usuario, guardar y cargar el grafo HNSW, que el arbol de sufijos no pierda
+// candidatas y que las recomendaciones por indice den lo mismo que la version de referencia. Los catalogos son
+// sinteticos y con semilla fija, asi que no hace falta el CSV. Se ejecutan con ctest.
+#define PROGRAIII_SIN_MAIN
+#include "../main.cpp"
+
+#include <random>
+
+int fallos = 0;
+
+#define COMPROBAR(condicion)                                                              \
+    do {                                                                                  \
+        if (!(condicion)) {                                                               \
+            cerr << __FILE__ << ":" << __LINE__ << ": fallo: " << #condicion << endl;     \
+            fallos++;                                                                     \
+        }                                                                                 \
+    } while (0)
+
+// Catalogo chico con etiquetas que solo difieren en mayusculas y repetidas dentro de una pelicula.
+vector<Pelicula> catalogoSintetico(size_t n, mt19937 &gen) {
+    const vector<string> palabras = {"star", "war", "wars", "king", "queen", "love", "dark", "night", "the", "a"};
+    const vector<string> etiquetas = {"Action", "action", "Drama", "drama", "Comedy", "cult", "Cult", "war"};
+    vector<Pelicula> peliculas(n);
+    for (size_t i = 0; i < n; i++) {
+        Pelicula &p = peliculas[i];
+        p.id = "tt" + to_string(1000000 + i);
+        for (int k = gen() % 3 + 1; k > 0; k--)
+            p.titulo += (p.titulo.empty() ? "" : " ") + palabras[gen() % palabras.size()];
+        for (int k = gen() % 20 + 5; k > 0; k--)
+            p.sinopsis += (p.sinopsis.empty() ? "" : " ") + palabras[gen() % palabras.size()];
+        for (int k = gen() % 4 + 1; k > 0; k--)
+            p.etiquetas.push_back(etiquetas[gen() % etiquetas.size()]);
+        p.fuente = "imdb";
+    }
+    return peliculas;
+}
+
+void probarCodecPosiciones() {
+    mt19937 gen(1);
+    vector<vector<int>> casos = {{}, {0}, {0, 1, 2}, {127, 128}, {5, 300, 70000, 70001, 1 << 30}};
+    vector<int> aleatorias;
+    for (int i = 0; i < 1000; i++)
+        aleatorias.push_back((aleatorias.empty() ? 0 : aleatorias.back()) + gen() % 5000);
+    casos.push_back(aleatorias);
+    for (const vector<int> &posiciones : casos) {
+        vector<unsigned char> codificadas;
+        codificarPosiciones(posiciones, codificadas);
+        COMPROBAR(decodificarPosiciones(codificadas) == posiciones);
+    }
+}
+
+// Las posiciones de cada posting, leidas del buffer de su palabra, son las del texto tokenizado.
+void probarIndicePosicional() {
+    mt19937 gen(5);
+    vector<Pelicula> peliculas = catalogoSintetico(700, gen);
+    IndicePalabras indice = construirIndice(peliculas);
+    map<pair<string, int>, vector<int>> esperadas;
+    for (size_t i = 0; i < peliculas.size(); i++) {
+        vector<string> tokensTitulo = tokenizar(peliculas[i].titulo);
+        int pos = 0;
+        for (const string &palabra : tokensTitulo)
+            esperadas[{palabra, (int)i}].push_back(pos++);
+        pos++;
+        for (const string &palabra : tokenizar(peliculas[i].sinopsis))
+            esperadas[{palabra, (int)i}].push_back(pos++);
+        COMPROBAR(indice.tokensTitulo[i] == (int)tokensTitulo.size());
+    }
+    size_t numPostings = 0;
+    for (const auto &par : indice.postings) {
+        const ListaPosicional &lista = par.second;
+        for (size_t k = 0; k < lista.postings.size(); k++) {
+            COMPROBAR(k == 0 || lista.postings[k - 1].pelicula < lista.postings[k].pelicula);
+            const vector<int> &posiciones = esperadas[make_pair(par.first, lista.postings[k].pelicula)];
+            COMPROBAR(lista.posicionesDe(k) == posiciones);
+        }
+        numPostings += lista.postings.size();
+    }
+    COMPROBAR(numPostings == esperadas.size());
+}
+
+void probarListaUsuario() {
+    vector<Pelicula> peliculas(200);
+    for (size_t i = 0; i < peliculas.size(); i++)
+        peliculas[i].id = "tt" + to_string(i);
+    ListaUsuario lista;
+    COMPROBAR(lista.vacia());
+    COMPROBAR(lista.agregar(130));
+    COMPROBAR(lista.agregar(3));
+    COMPROBAR(!lista.agregar(130));
+    COMPROBAR(!lista.agregar(-1));
+    COMPROBAR(lista.contiene(3) && lista.contiene(130) && !lista.contiene(4) && !lista.contiene(1000));
+    COMPROBAR((lista.ids() == vector<int>{130, 3}));
+    COMPROBAR(!lista.alternar(130));
+    COMPROBAR(lista.alternar(64));
+    COMPROBAR((lista.ids() == vector<int>{3, 64}));
+    COMPROBAR((lista.imdbIds(peliculas) == vector<string>{"tt3", "tt64"}));
+    COMPROBAR(lista.punteros(peliculas).front() == &peliculas[3]);
+    COMPROBAR(lista.quitar(3) && lista.quitar(64) && !lista.quitar(64));
+    COMPROBAR(lista.vacia());
+}
+
+void probarHNSWGuardarCargar() {
+    mt19937 gen(2);
+    normal_distribution<float> normal;
+    size_t n = 600;
+    vector<float> vectores(n * IndiceHNSW::DIMENSION);
+    for (size_t i = 0; i < n; i++) {
+        float norma = 0;
+        for (int d = 0; d < IndiceHNSW::DIMENSION; d++) {
+            float x = normal(gen);
+            vectores[i * IndiceHNSW::DIMENSION + d] = x;
+            norma += x * x;
+        }
+        for (int d = 0; d < IndiceHNSW::DIMENSION; d++)
+            vectores[i * IndiceHNSW::DIMENSION + d] /= sqrt(norma);
+    }
+    const string archivo = "pruebas_hnsw.bin";
+    IndiceHNSW original;
+    original.construir(vectores);
+    COMPROBAR(original.guardar(archivo));
+
+    IndiceHNSW cargado;
+    vector<float> copia = vectores;
+    COMPROBAR(cargado.cargar(archivo, copia));
+    COMPROBAR(cargado.tamano() == n);
+    for (int consulta = 0; consulta < 20; consulta++) {
+        const float* v = &vectores[consulta * IndiceHNSW::DIMENSION];
+        COMPROBAR(cargado.buscar(v, 10) == original.buscar(v, 10));
+    }
+
+    // Con otros vectores la huella no coincide: no se carga y los vectores quedan intactos.
+    IndiceHNSW otro;
+    vector<float> distintos = vectores;
+    distintos[0] += 0.5f;
+    vector<float> antes = distintos;
+    COMPROBAR(!otro.cargar(archivo, distintos));
+    COMPROBAR(distintos == antes);
+    remove(archivo.c_str());
+}
+
+void probarArbolSufijos() {
+    mt19937 gen(3);
+    vector<Pelicula> peliculas = catalogoSintetico(500, gen);
+    vector<uint32_t> inicios;
+    string texto = construirTextoGlobal(peliculas, inicios);
+    ArbolSufijosUkkonen arbol(move(texto), move(inicios));
+    EstrategiaTituloSinopsis conArbol(&arbol), sinArbol(nullptr);
+    for (string consulta : {"star", "star war", "ar w", "queen", "the", "a", "zzz", "night love", "r"}) {
+        vector<pair<Pelicula*, int>> a = conArbol.buscar(peliculas, consulta);
+        vector<pair<Pelicula*, int>> b = sinArbol.buscar(peliculas, consulta);
+        sort(a.begin(), a.end(), CursorResultados::antes);
+        sort(b.begin(), b.end(), CursorResultados::antes);
+        COMPROBAR(a == b);
+    }
+
+    // El modo lote puntua las candidatas del arbol con el texto ya pasado a minusculas.
+    InstantaneaCatalogo catalogo(1, make_shared<vector<Pelicula>>(peliculas));
+    vector<string> consultas = {"star", "star war", "ar w", "queen", "the", "a", "zzz", "night love", "r"};
+    MemoriaLote memoria = prepararMemoriaLote(catalogo, consultas, 1);
+    EstrategiaTituloSinopsis conLote(catalogo.arbol.get(), true, &memoria), lineal(nullptr);
+    for (const string &consulta : consultas) {
+        vector<pair<Pelicula*, int>> a = conLote.buscar(catalogo.peliculas, consulta);
+        vector<pair<Pelicula*, int>> b = lineal.buscar(catalogo.peliculas, consulta);
+        sort(a.begin(), a.end(), CursorResultados::antes);
+        sort(b.begin(), b.end(), CursorResultados::antes);
+        COMPROBAR(a == b);
+    }
+}
+
+void probarRecomendaciones() {
+    mt19937 gen(4);
+    vector<Pelicula> peliculas = catalogoSintetico(400, gen);
+    IndiceEtiquetas indice = construirIndiceEtiquetas(peliculas);
+    ContadoresPopularidad popularidad(peliculas.size());
+    for (int i = 0; i < 100; i++)
+        popularidad.sumarLike(gen() % peliculas.size(), 1);
+    popularidad.consolidar();
+    for (int usuario = 0; usuario < 200; usuario++) {
+        ListaUsuario gustadas;
+        for (int k = gen() % 4 + 1; k > 0; k--)
+            gustadas.agregar(gen() % peliculas.size());
+        const ContadoresPopularidad* pop = (usuario % 2) ? &popularidad : nullptr;
+        vector<int> referencia;
+        for (Pelicula* p : recomendarPeliculas(peliculas, gustadas, pop))
+            referencia.push_back(p - peliculas.data());
+        COMPROBAR(recomendarPorEtiquetas(indice, peliculas, gustadas.ids(), pop) == referencia);
+    }
+}
+
+int main() {
+    probarCodecPosiciones();
+    probarIndicePosicional();
+    probarListaUsuario();
+    probarHNSWGuardarCargar();
+    probarArbolSufijos();
+    probarRecomendaciones();
+    if (fallos > 0) {
+        cerr << fallos << " comprobaciones fallidas." << endl;
+        return 1;
+    }
+    cout << "Todas las pruebas pasaron." << endl;
+    return 0;
+}